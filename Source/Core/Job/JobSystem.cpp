@@ -0,0 +1,81 @@
+#include "JobSystem.h"
+#include <algorithm>
+#include <atomic>
+
+JobSystem::JobSystem(size_t threadCount) {
+	//The calling thread always takes part, so one thread less is spawned
+	for (size_t i = 1; i < threadCount; i++) {
+		workers.emplace_back(&JobSystem::WorkerLoop, this);
+	}
+}
+
+JobSystem::~JobSystem() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	condition.notify_all();
+	for (auto& worker : workers) {
+		worker.join();
+	}
+}
+
+JobSystem& JobSystem::Get() {
+	static JobSystem jobSystem;
+	return jobSystem;
+}
+
+void JobSystem::ParallelFor(size_t count, size_t batchSize, const std::function<void(size_t begin, size_t end)>& function) {
+	if (count == 0) return;
+	size_t batchCount = (count + batchSize - 1) / batchSize;
+	size_t helperCount = std::min(workers.size(), batchCount - 1);
+	if (helperCount == 0) {
+		function(0, count);
+		return;
+	}
+
+	//Ranges are handed out through one counter, helpers that start late simply find nothing left
+	std::atomic<size_t> nextBatch{ 0 };
+	std::atomic<size_t> runningHelpers{ helperCount };
+	std::mutex doneMutex;
+	std::condition_variable done;
+
+	auto run = [&]() {
+		for (size_t batch = nextBatch++; batch < batchCount; batch = nextBatch++) {
+			size_t begin = batch * batchSize;
+			function(begin, std::min(begin + batchSize, count));
+		}
+	};
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (size_t i = 0; i < helperCount; i++) {
+			jobs.push([&]() {
+				run();
+				std::lock_guard<std::mutex> doneLock(doneMutex);
+				if (--runningHelpers == 0) done.notify_one();
+			});
+		}
+	}
+	condition.notify_all();
+
+	run();
+
+	//The jobs reference this stack frame, so every helper has to be finished before returning
+	std::unique_lock<std::mutex> doneLock(doneMutex);
+	done.wait(doneLock, [&]() { return runningHelpers == 0; });
+}
+
+void JobSystem::WorkerLoop() {
+	for (;;) {
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [this]() { return stop || !jobs.empty(); });
+			if (stop && jobs.empty()) return;
+			job = std::move(jobs.front());
+			jobs.pop();
+		}
+		job();
+	}
+}
\ No newline at end of file
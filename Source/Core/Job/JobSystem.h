@@ -0,0 +1,31 @@
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+//Fixed pool of worker threads shared by every pipeline stage
+class JobSystem {
+public:
+	JobSystem(size_t threadCount = std::thread::hardware_concurrency());
+	~JobSystem();
+
+	static JobSystem& Get();
+
+	//Splits [0, count) into ranges of at most batchSize and runs them on the workers and the calling thread,
+	//returns once every range is done. Must not be called from inside a job
+	void ParallelFor(size_t count, size_t batchSize, const std::function<void(size_t begin, size_t end)>& function);
+
+	size_t GetThreadCount()const { return workers.size() + 1; }
+
+private:
+	void WorkerLoop();
+
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> jobs;
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool stop{ false };
+};
\ No newline at end of file
@@ -0,0 +1,209 @@
+#include "Batch.h"
+#include "Core/Job/JobSystem.h"
+#if defined(__AVX512F__) || defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+//Widest vector type the build targets, AVX-512 and AVX2 kernels are chosen with /arch:AVX512, /arch:AVX2 or the -m flags.
+//Every lane performs the scalar operations in the scalar order, so the kernels agree with the single element functions
+#if defined(__AVX512F__)
+#define BATCH_SIMD
+struct FloatN {
+	using Type = __m512;
+	static const size_t width = 16;
+	static Type Load(const float* p) { return _mm512_loadu_ps(p); }
+	static void Store(float* p, Type v) { _mm512_storeu_ps(p, v); }
+	static Type Set(float a) { return _mm512_set1_ps(a); }
+	static Type Add(Type a, Type b) { return _mm512_add_ps(a, b); }
+	static Type Mul(Type a, Type b) { return _mm512_mul_ps(a, b); }
+	static Type Div(Type a, Type b) { return _mm512_div_ps(a, b); }
+	static Type Sqrt(Type a) { return _mm512_sqrt_ps(a); }
+	//A matrix row repeated in every 128 bit lane, and component i of each Vector4f splatted across its lane
+	static Type LoadRow(const float* p) { return _mm512_broadcast_f32x4(_mm_loadu_ps(p)); }
+	template<int i> static Type Splat(Type v) { return _mm512_permute_ps(v, i * 0x55); }
+};
+#elif defined(__AVX__)
+#define BATCH_SIMD
+struct FloatN {
+	using Type = __m256;
+	static const size_t width = 8;
+	static Type Load(const float* p) { return _mm256_loadu_ps(p); }
+	static void Store(float* p, Type v) { _mm256_storeu_ps(p, v); }
+	static Type Set(float a) { return _mm256_set1_ps(a); }
+	static Type Add(Type a, Type b) { return _mm256_add_ps(a, b); }
+	static Type Mul(Type a, Type b) { return _mm256_mul_ps(a, b); }
+	static Type Div(Type a, Type b) { return _mm256_div_ps(a, b); }
+	static Type Sqrt(Type a) { return _mm256_sqrt_ps(a); }
+	static Type LoadRow(const float* p) { return _mm256_broadcast_ps(reinterpret_cast<const __m128*>(p)); }
+	template<int i> static Type Splat(Type v) { return _mm256_permute_ps(v, i * 0x55); }
+};
+#elif defined(MATH_SSE)
+#define BATCH_SIMD
+struct FloatN {
+	using Type = __m128;
+	static const size_t width = 4;
+	static Type Load(const float* p) { return _mm_loadu_ps(p); }
+	static void Store(float* p, Type v) { _mm_storeu_ps(p, v); }
+	static Type Set(float a) { return _mm_set1_ps(a); }
+	static Type Add(Type a, Type b) { return _mm_add_ps(a, b); }
+	static Type Mul(Type a, Type b) { return _mm_mul_ps(a, b); }
+	static Type Div(Type a, Type b) { return _mm_div_ps(a, b); }
+	static Type Sqrt(Type a) { return _mm_sqrt_ps(a); }
+	static Type LoadRow(const float* p) { return _mm_loadu_ps(p); }
+	template<int i> static Type Splat(Type v) { return _mm_shuffle_ps(v, v, i * 0x55); }
+};
+#endif
+
+static const size_t batchJobSize = 1 << 14;
+//AoS Vector3f arrays are transposed through blocks of this size on the stack
+static const size_t transposeBlockSize = 64;
+
+template<typename Function>
+static void ForEachRange(size_t count, const Function& function) {
+	if (count >= batchParallelCount) JobSystem::Get().ParallelFor(count, batchJobSize, function);
+	else function(0, count);
+}
+
+static void TransformPointsSoA(const float* x, const float* y, const float* z, const float* w,
+	float* const out[4], size_t begin, size_t end, const Matrix4x4f& m) {
+	const float columns[4][4] = {
+		{ m.a1, m.b1, m.c1, m.d1 },
+		{ m.a2, m.b2, m.c2, m.d2 },
+		{ m.a3, m.b3, m.c3, m.d3 },
+		{ m.a4, m.b4, m.c4, m.d4 }
+	};
+
+	size_t i = begin;
+#if defined(BATCH_SIMD)
+	for (; i + FloatN::width <= end; i += FloatN::width) {
+		FloatN::Type vx = FloatN::Load(x + i), vy = FloatN::Load(y + i), vz = FloatN::Load(z + i);
+		FloatN::Type vw = w ? FloatN::Load(w + i) : FloatN::Set(1.0f);
+		for (size_t c = 0; c < 4; c++) {
+			if (!out[c]) continue;
+			FloatN::Type result = FloatN::Add(FloatN::Mul(vx, FloatN::Set(columns[c][0])), FloatN::Mul(vy, FloatN::Set(columns[c][1])));
+			result = FloatN::Add(result, FloatN::Mul(vz, FloatN::Set(columns[c][2])));
+			result = FloatN::Add(result, w ? FloatN::Mul(vw, FloatN::Set(columns[c][3])) : FloatN::Set(columns[c][3]));
+			FloatN::Store(out[c] + i, result);
+		}
+	}
+#endif
+	//Components are read before any output is written, so the arrays may alias
+	for (; i < end; i++) {
+		float px = x[i], py = y[i], pz = z[i], pw = w ? w[i] : 1.0f;
+		for (size_t c = 0; c < 4; c++) {
+			if (!out[c]) continue;
+			float result = px * columns[c][0] + py * columns[c][1] + pz * columns[c][2];
+			out[c][i] = w ? result + pw * columns[c][3] : result + columns[c][3];
+		}
+	}
+}
+
+static void TransformNormalsSoA(const float* x, const float* y, const float* z,
+	float* outX, float* outY, float* outZ, size_t begin, size_t end, const Matrix4x4f& m) {
+	size_t i = begin;
+#if defined(BATCH_SIMD)
+	for (; i + FloatN::width <= end; i += FloatN::width) {
+		FloatN::Type vx = FloatN::Load(x + i), vy = FloatN::Load(y + i), vz = FloatN::Load(z + i);
+		FloatN::Store(outX + i, FloatN::Add(FloatN::Add(FloatN::Mul(vx, FloatN::Set(m.a1)), FloatN::Mul(vy, FloatN::Set(m.b1))), FloatN::Mul(vz, FloatN::Set(m.c1))));
+		FloatN::Store(outY + i, FloatN::Add(FloatN::Add(FloatN::Mul(vx, FloatN::Set(m.a2)), FloatN::Mul(vy, FloatN::Set(m.b2))), FloatN::Mul(vz, FloatN::Set(m.c2))));
+		FloatN::Store(outZ + i, FloatN::Add(FloatN::Add(FloatN::Mul(vx, FloatN::Set(m.a3)), FloatN::Mul(vy, FloatN::Set(m.b3))), FloatN::Mul(vz, FloatN::Set(m.c3))));
+	}
+#endif
+	for (; i < end; i++) {
+		float nx = x[i], ny = y[i], nz = z[i];
+		outX[i] = nx * m.a1 + ny * m.b1 + nz * m.c1;
+		outY[i] = nx * m.a2 + ny * m.b2 + nz * m.c2;
+		outZ[i] = nx * m.a3 + ny * m.b3 + nz * m.c3;
+	}
+}
+
+static void NormalizeSoA(float* x, float* y, float* z, size_t begin, size_t end) {
+	size_t i = begin;
+#if defined(BATCH_SIMD)
+	for (; i + FloatN::width <= end; i += FloatN::width) {
+		FloatN::Type vx = FloatN::Load(x + i), vy = FloatN::Load(y + i), vz = FloatN::Load(z + i);
+		FloatN::Type length = FloatN::Sqrt(FloatN::Add(FloatN::Add(FloatN::Mul(vx, vx), FloatN::Mul(vy, vy)), FloatN::Mul(vz, vz)));
+		FloatN::Store(x + i, FloatN::Div(vx, length));
+		FloatN::Store(y + i, FloatN::Div(vy, length));
+		FloatN::Store(z + i, FloatN::Div(vz, length));
+	}
+#endif
+	for (; i < end; i++) {
+		Vector3f v = Vector3f(x[i], y[i], z[i]).Normalize();
+		x[i] = v.x, y[i] = v.y, z[i] = v.z;
+	}
+}
+
+void TransformPoints(const Vector4f* in, Vector4f* out, size_t count, const Matrix4x4f& m) {
+	ForEachRange(count, [&](size_t begin, size_t end) {
+		size_t i = begin;
+#if defined(BATCH_SIMD)
+		//Each vector register holds whole Vector4f, the result is the weighted sum of the matrix rows as in Multiply
+		const size_t perVector = FloatN::width / 4;
+		FloatN::Type row1 = FloatN::LoadRow(&m.a1), row2 = FloatN::LoadRow(&m.b1), row3 = FloatN::LoadRow(&m.c1), row4 = FloatN::LoadRow(&m.d1);
+		for (; i + perVector <= end; i += perVector) {
+			FloatN::Type v = FloatN::Load(&in[i].x);
+			FloatN::Type result = FloatN::Add(FloatN::Mul(FloatN::Splat<0>(v), row1), FloatN::Mul(FloatN::Splat<1>(v), row2));
+			result = FloatN::Add(result, FloatN::Mul(FloatN::Splat<2>(v), row3));
+			result = FloatN::Add(result, FloatN::Mul(FloatN::Splat<3>(v), row4));
+			FloatN::Store(&out[i].x, result);
+		}
+#endif
+		for (; i < end; i++) {
+			out[i] = Multiply(in[i], m);
+		}
+	});
+}
+
+void TransformNormals(const Vector3f* in, Vector3f* out, size_t count, const Matrix4x4f& m) {
+	ForEachRange(count, [&](size_t begin, size_t end) {
+		float x[transposeBlockSize], y[transposeBlockSize], z[transposeBlockSize];
+		for (size_t first = begin; first < end; first += transposeBlockSize) {
+			size_t n = std::min(transposeBlockSize, end - first);
+			for (size_t i = 0; i < n; i++) {
+				x[i] = in[first + i].x, y[i] = in[first + i].y, z[i] = in[first + i].z;
+			}
+			TransformNormalsSoA(x, y, z, x, y, z, 0, n, m);
+			for (size_t i = 0; i < n; i++) {
+				out[first + i] = Vector3f(x[i], y[i], z[i]);
+			}
+		}
+	});
+}
+
+void NormalizeArray(const Vector3f* in, Vector3f* out, size_t count) {
+	ForEachRange(count, [&](size_t begin, size_t end) {
+		float x[transposeBlockSize], y[transposeBlockSize], z[transposeBlockSize];
+		for (size_t first = begin; first < end; first += transposeBlockSize) {
+			size_t n = std::min(transposeBlockSize, end - first);
+			for (size_t i = 0; i < n; i++) {
+				x[i] = in[first + i].x, y[i] = in[first + i].y, z[i] = in[first + i].z;
+			}
+			NormalizeSoA(x, y, z, 0, n);
+			for (size_t i = 0; i < n; i++) {
+				out[first + i] = Vector3f(x[i], y[i], z[i]);
+			}
+		}
+	});
+}
+
+void TransformPoints(const float* x, const float* y, const float* z, const float* w,
+	float* outX, float* outY, float* outZ, float* outW, size_t count, const Matrix4x4f& m) {
+	float* const out[4] = { outX, outY, outZ, outW };
+	ForEachRange(count, [&](size_t begin, size_t end) {
+		TransformPointsSoA(x, y, z, w, out, begin, end, m);
+	});
+}
+
+void TransformNormals(const float* x, const float* y, const float* z,
+	float* outX, float* outY, float* outZ, size_t count, const Matrix4x4f& m) {
+	ForEachRange(count, [&](size_t begin, size_t end) {
+		TransformNormalsSoA(x, y, z, outX, outY, outZ, begin, end, m);
+	});
+}
+
+void NormalizeArray(float* x, float* y, float* z, size_t count) {
+	ForEachRange(count, [&](size_t begin, size_t end) {
+		NormalizeSoA(x, y, z, begin, end);
+	});
+}
\ No newline at end of file
@@ -0,0 +1,20 @@
+#pragma once
+#include "Core/Math/Math.h"
+
+//Array versions of the single element operations, in and out may be the same array.
+//Every point matches Multiply bit for bit and every normalized vector matches Normalize,
+//arrays of at least batchParallelCount elements are split across the job system
+const size_t batchParallelCount = 1 << 16;
+
+//Points are multiplied with their own w
+void TransformPoints(const Vector4f* in, Vector4f* out, size_t count, const Matrix4x4f& m);
+//Normals are multiplied with w = 0, only the upper 3x3 of m applies
+void TransformNormals(const Vector3f* in, Vector3f* out, size_t count, const Matrix4x4f& m);
+void NormalizeArray(const Vector3f* in, Vector3f* out, size_t count);
+
+//SoA versions over separate component arrays, a null w input reads as one and null outputs are skipped
+void TransformPoints(const float* x, const float* y, const float* z, const float* w,
+	float* outX, float* outY, float* outZ, float* outW, size_t count, const Matrix4x4f& m);
+void TransformNormals(const float* x, const float* y, const float* z,
+	float* outX, float* outY, float* outZ, size_t count, const Matrix4x4f& m);
+void NormalizeArray(float* x, float* y, float* z, size_t count);
\ No newline at end of file
@@ -0,0 +1,117 @@
+#pragma once
+#include "Core/Math/Math.h"
+#include <cstring>
+
+//Accuracy tiers for the math that runs once per fragment. Measured relative error bounds with s = max(1, |y * log2(x)|),
+//x in (0, 1] and y in [1, 256] for Pow:
+//Precise:     the C library and the plain Normalize, bit identical to code that does not use this header
+//Fast:        ReciprocalSqrt/Normalize 3e-7, Pow 3.5e-7 * s, Pow5 2.3e-7
+//Approximate: ReciprocalSqrt/Normalize 3.3e-4, Pow 3.4e-4 * s, Pow5 2.3e-7
+//Pow expects x >= 0 and y > 0, as in specular and spot light falloff
+enum class MathPrecision {
+	Precise = 0,
+	Fast,
+	Approximate
+};
+
+//The hardware estimate on SSE (12 bits) and NEON (8 bits, refined once so both reach 12), a bit trick refined twice otherwise
+inline float ReciprocalSqrtEstimate(float x) {
+#if defined(MATH_SSE)
+	return _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+#elif defined(MATH_NEON)
+	float y = vrsqrtes_f32(x);
+	return y * vrsqrtss_f32(x * y, y);
+#else
+	uint32_t bits;
+	memcpy(&bits, &x, sizeof(float));
+	bits = 0x5f3759df - (bits >> 1);
+	float y;
+	memcpy(&y, &bits, sizeof(float));
+	y = y * (1.5f - 0.5f * x * y * y);
+	return y * (1.5f - 0.5f * x * y * y);
+#endif
+}
+
+template<MathPrecision precision> inline float ReciprocalSqrt(float x) {
+	if (precision == MathPrecision::Precise)
+		return 1.0f / sqrtf(x);
+
+	float y = ReciprocalSqrtEstimate(x);
+	if (precision == MathPrecision::Fast)
+		y = y * (1.5f - 0.5f * x * y * y);
+	return y;
+}
+
+template<MathPrecision precision> inline Vector3f Normalize(Vector3f v) {
+	if (precision == MathPrecision::Precise)
+		return v.Normalize();
+	return ReciprocalSqrt<precision>(Dot(v, v)) * v;
+}
+
+//x = m * 2^e with m reduced to [sqrt(0.5), sqrt(2)), so x just below one keeps a small absolute error.
+//log2(1 + u) = u * g(u), g is fitted over that range with degree 7 for Fast and degree 3 for Approximate
+template<MathPrecision precision> inline float Log2(float x) {
+	if (precision == MathPrecision::Precise)
+		return log2f(x);
+
+	uint32_t bits;
+	memcpy(&bits, &x, sizeof(float));
+	int exponent = (int)(bits >> 23) - 127;
+	bits = (bits & 0x007fffff) | 0x3f800000;
+	float m;
+	memcpy(&m, &bits, sizeof(float));
+	bool high = m > 1.41421356f;
+	m = high ? m * 0.5f : m;
+	exponent += high;
+
+	float u = m - 1.0f;
+	float g;
+	if (precision == MathPrecision::Fast) {
+		g = 1.44269499f + u * (-0.721352931f + u * (0.480916708f + u * (-0.360225182f +
+			u * (0.287288882f + u * (-0.249271822f + u * (0.232652579f + u * -0.142759734f))))));
+	}
+	else {
+		g = 1.44230705f + u * (-0.724699847f + u * (0.510183237f + u * -0.322623591f));
+	}
+	return (float)exponent + u * g;
+}
+
+//2^v = 2^i * 2^f with i the nearest integer and f in [-0.5, 0.5], 2^f is fitted with degree 5 for Fast and degree 3 for Approximate.
+//Below 2^-126 the result flushes to zero. Both Log2 and Exp2 are branch free so loops over them can vectorize
+template<MathPrecision precision> inline float Exp2(float v) {
+	if (precision == MathPrecision::Precise)
+		return exp2f(v);
+
+	float clamped = min(max(v, -127.0f), 127.0f);
+	//Truncating a positive value rounds down, the offset turns that into round to nearest
+	int i = (int)(clamped + 128.5f) - 128;
+	float f = clamped - (float)i;
+
+	float p;
+	if (precision == MathPrecision::Fast) {
+		p = 1.00000008f + f * (0.693147188f + f * (0.240221075f + f * (0.0555035711f + f * (0.00967603192f + f * 0.00133908634f))));
+	}
+	else {
+		p = 0.999924557f + f * (0.693136734f + f * (0.242639479f + f * 0.0558382829f));
+	}
+
+	uint32_t bits = (uint32_t)(i + 127) << 23;
+	float scale;
+	memcpy(&scale, &bits, sizeof(float));
+	return v < -126.0f ? 0.0f : p * scale;
+}
+
+template<MathPrecision precision> inline float Pow(float x, float y) {
+	if (precision == MathPrecision::Precise)
+		return powf(x, y);
+	float result = Exp2<precision>(y * Log2<precision>(x));
+	return x > 0.0f ? result : 0.0f;
+}
+
+//Three multiplies instead of a general pow
+template<MathPrecision precision> inline float Pow5(float x) {
+	if (precision == MathPrecision::Precise)
+		return powf(x, 5.0f);
+	float x2 = x * x;
+	return x2 * x2 * x;
+}
\ No newline at end of file
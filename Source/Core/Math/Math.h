@@ -5,14 +5,42 @@
 #include <algorithm>
 #include <vector>
 
-float min(float a, float b);
-float max(float a, float b);
-float saturate(float a);
+//Vector4f and Matrix4x4f arithmetic uses SSE when the target guarantees it (every x64 build) and NEON on ARM,
+//MATH_NO_SIMD forces the scalar path. Both paths perform the same operations in the same order without fused
+//multiply-add, so they give identical results as long as the compiler does not contract floating point expressions
+#if !defined(MATH_NO_SIMD) && (defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+#define MATH_SSE
+#include <xmmintrin.h>
+#elif !defined(MATH_NO_SIMD) && (defined(__ARM_NEON) || defined(_M_ARM64))
+#define MATH_NEON
+#include <arm_neon.h>
+#endif
+
+inline float min(float a, float b) {
+	return a < b ? a : b;
+}
+
+inline float max(float a, float b) {
+	return a > b ? a : b;
+}
+
+inline float saturate(float a) {
+	a = a > 1.0f ? 1.0f : a;
+	a = a < 0.0f ? 0.0f : a;
+	return a;
+}
 
 long Factorial(size_t n);
 
-float Lerp(float v0, float v1, float percent);
-float PerspectiveCorrectInterpolate(float z1, float z2, float z3, float n1, float n2, float n3, float u, float v);
+inline float Lerp(float v0, float v1, float percent) {
+	return v0 * (1.0f - percent) + v1 * percent;
+}
+
+inline float PerspectiveCorrectInterpolate(float z1, float z2, float z3, float n1, float n2, float n3, float u, float v) {
+	float zt = 1.0f / ((1.0f - u - v) / z1 + u / z2 + v / z3);
+	float nt = ((1.0f - u - v) / z1 * n1 + u / z2 * n2 + v / z3 * n3) * zt;
+	return nt;
+}
 
 struct Vector2i {
 	Vector2i() {}
@@ -20,23 +48,52 @@ struct Vector2i {
 	int x{ 0 }, y{ 0 };
 };
 
-Vector2i operator+(const Vector2i& v0, const Vector2i& v1);
-Vector2i operator-(const Vector2i& v0, const Vector2i& v1);
+inline Vector2i operator+(const Vector2i& v0, const Vector2i& v1) {
+	return Vector2i(v0.x + v1.x, v0.y + v1.y);
+}
+
+inline Vector2i operator-(const Vector2i& v0, const Vector2i& v1) {
+	return Vector2i(v0.x - v1.x, v0.y - v1.y);
+}
 
 struct Vector2f {
 	Vector2f() {}
 	Vector2f(float x, float y) : x(x), y(y) {}
 	float x{ 0.0f }, y{ 0.0f };
 
-	float Length()const;
+	float Length()const { return sqrtf(x * x + y * y); }
 };
 
-Vector2f operator*(const float& a, const Vector2f& v);
-Vector2f operator+(const Vector2f& v0, const Vector2f& v1);
-
-Vector2f Lerp(Vector2f v0, Vector2f v1, float percent);
-Vector2f PerspectiveCorrectInterpolate(float z1, float z2, Vector2f n1, Vector2f n2, float percent);
-Vector2f PerspectiveCorrectInterpolate(float z1, float z2, float z3, Vector2f n1, Vector2f n2, Vector2f n3, float u, float v);
+inline Vector2f operator*(const float& a, const Vector2f& v) {
+	return Vector2f(a * v.x, a * v.y);
+}
+
+inline Vector2f operator+(const Vector2f& v0, const Vector2f& v1) {
+	return Vector2f(v0.x + v1.x, v0.y + v1.y);
+}
+
+inline Vector2f Lerp(Vector2f v0, Vector2f v1, float percent) {
+	return Vector2f(
+		Lerp(v0.x, v1.x, percent),
+		Lerp(v0.y, v1.y, percent)
+	);
+}
+
+inline Vector2f PerspectiveCorrectInterpolate(float z1, float z2, Vector2f n1, Vector2f n2, float percent) {
+	float zt = 1.0f / ((1.0f - percent) / z1 + percent / z2);
+	Vector2f nt;
+	nt.x = ((1.0f - percent) / z1 * n1.x + percent / z2 * n2.x) * zt;
+	nt.y = ((1.0f - percent) / z1 * n1.y + percent / z2 * n2.y) * zt;
+	return nt;
+}
+
+inline Vector2f PerspectiveCorrectInterpolate(float z1, float z2, float z3, Vector2f n1, Vector2f n2, Vector2f n3, float u, float v) {
+	float zt = 1.0f / ((1.0f - u - v) / z1 + u / z2 + v / z3);
+	Vector2f nt;
+	nt.x = ((1.0f - u - v) / z1 * n1.x + u / z2 * n2.x + v / z3 * n3.x) * zt;
+	nt.y = ((1.0f - u - v) / z1 * n1.y + u / z2 * n2.y + v / z3 * n3.y) * zt;
+	return nt;
+}
 
 struct Vector3i {
 	Vector3i() {}
@@ -44,7 +101,13 @@ struct Vector3i {
 	int x{ 0 }, y{ 0 }, z{ 0 };
 };
 
-Vector3i Cross(Vector3i v0, Vector3i v1);
+inline Vector3i Cross(Vector3i v0, Vector3i v1) {
+	Vector3i v;
+	v.x = v0.y * v1.z - v0.z * v1.y;
+	v.y = v0.z * v1.x - v0.x * v1.z;
+	v.z = v0.x * v1.y - v0.y * v1.x;
+	return v;
+}
 
 struct Vector3f {
 	Vector3f() {}
@@ -52,23 +115,69 @@ struct Vector3f {
 	Vector3f(float x, float y, float z) : x(x), y(y), z(z) {}
 	float x{ 0.0f }, y{ 0.0f }, z{ 0.0f };
 
-	float Length()const;
-	Vector3f Normalize()const;
+	float Length()const { return sqrtf(x * x + y * y + z * z); }
+	Vector3f Normalize()const {
+		float length = Length();
+		return Vector3f(x / length, y / length, z / length);
+	}
 };
 
-Vector3f operator-(const Vector3f& v);
-Vector3f operator+(const Vector3f& v0, const Vector3f& v1);
-Vector3f operator-(const Vector3f& v0, const Vector3f& v1);
-Vector3f operator*(const float& a, const Vector3f& v);
-Vector3f operator*(const Vector3f& v0, const Vector3f& v1);
-Vector3f operator/(const Vector3f& v, const float& a);
-
-Vector3f saturate(const Vector3f& v);
-Vector3f Lerp(Vector3f v0, Vector3f v1, float percent);
-Vector3f PerspectiveCorrectInterpolate(float z1, float z2, float z3, Vector3f n1, Vector3f n2, Vector3f n3, float u, float v);
-
-float Dot(Vector3f v0, Vector3f v1);
-Vector3f Cross(Vector3f v0, Vector3f v1);
+inline Vector3f operator-(const Vector3f& v) {
+	return Vector3f(-v.x, -v.y, -v.z);
+}
+
+inline Vector3f operator+(const Vector3f& v0, const Vector3f& v1) {
+	return Vector3f(v0.x + v1.x, v0.y + v1.y, v0.z + v1.z);
+}
+
+inline Vector3f operator-(const Vector3f& v0, const Vector3f& v1) {
+	return Vector3f(v0.x - v1.x, v0.y - v1.y, v0.z - v1.z);
+}
+
+inline Vector3f operator*(const float& a, const Vector3f& v) {
+	return Vector3f(a * v.x, a * v.y, a * v.z);
+}
+
+inline Vector3f operator*(const Vector3f& v0, const Vector3f& v1) {
+	return Vector3f(v0.x * v1.x, v0.y * v1.y, v0.z * v1.z);
+}
+
+inline Vector3f operator/(const Vector3f& v, const float& a) {
+	return Vector3f(v.x / a, v.y / a, v.z / a);
+}
+
+inline Vector3f saturate(const Vector3f& v) {
+	return Vector3f(saturate(v.x), saturate(v.y), saturate(v.z));
+}
+
+inline Vector3f Lerp(Vector3f v0, Vector3f v1, float percent) {
+	return Vector3f(
+		Lerp(v0.x, v1.x, percent),
+		Lerp(v0.y, v1.y, percent),
+		Lerp(v0.z, v1.z, percent)
+	);
+}
+
+inline Vector3f PerspectiveCorrectInterpolate(float z1, float z2, float z3, Vector3f n1, Vector3f n2, Vector3f n3, float u, float v) {
+	float zt = 1.0f / ((1.0f - u - v) / z1 + u / z2 + v / z3);
+	Vector3f nt;
+	nt.x = ((1.0f - u - v) / z1 * n1.x + u / z2 * n2.x + v / z3 * n3.x) * zt;
+	nt.y = ((1.0f - u - v) / z1 * n1.y + u / z2 * n2.y + v / z3 * n3.y) * zt;
+	nt.z = ((1.0f - u - v) / z1 * n1.z + u / z2 * n2.z + v / z3 * n3.z) * zt;
+	return nt;
+}
+
+inline float Dot(Vector3f v0, Vector3f v1) {
+	return v0.x * v1.x + v0.y * v1.y + v0.z * v1.z;
+}
+
+inline Vector3f Cross(Vector3f v0, Vector3f v1) {
+	Vector3f v;
+	v.x = v0.y * v1.z - v0.z * v1.y;
+	v.y = v0.z * v1.x - v0.x * v1.z;
+	v.z = v0.x * v1.y - v0.y * v1.x;
+	return v;
+}
 
 Vector3f Reflect(Vector3f v, Vector3f n);
 Vector3f Refract(Vector3f v, Vector3f n, float refIndex, float& cosFraction);
@@ -83,20 +192,89 @@ struct Vector4f {
 
 	float x{ 0.0f }, y{ 0.0f }, z{ 0.0f }, w{ 0.0f };
 
-	float Length()const;
-	Vector4f Normalize()const;
+	float Length()const { return sqrtf(x * x + y * y + z * z); }
+	Vector4f Normalize()const {
+		float length = Length();
+		return Vector4f(x / length, y / length, z / length, w);
+	}
 };
 
-Vector4f operator+(const Vector4f& v0, const Vector4f& v1);
-Vector4f operator-(const Vector4f& v0, const Vector4f& v1);
-Vector4f operator*(const float& a, const Vector4f& v);
-Vector4f operator*(const Vector4f& v0, const Vector4f& v1);
-
-Vector4f saturate(const Vector4f& v);
-Vector4f Lerp(Vector4f v0, Vector4f v1, float percent);
-Vector4f PerspectiveCorrectInterpolate(float z1, float z2, float z3, Vector4f n1, Vector4f n2, Vector4f n3, float u, float v);
-
-float Dot(Vector4f v0, Vector4f v1);
+#if defined(MATH_SSE)
+inline __m128 LoadVector4f(const Vector4f& v) { return _mm_loadu_ps(&v.x); }
+inline Vector4f StoreVector4f(__m128 v) { Vector4f result; _mm_storeu_ps(&result.x, v); return result; }
+#elif defined(MATH_NEON)
+inline float32x4_t LoadVector4f(const Vector4f& v) { return vld1q_f32(&v.x); }
+inline Vector4f StoreVector4f(float32x4_t v) { Vector4f result; vst1q_f32(&result.x, v); return result; }
+#endif
+
+inline Vector4f operator+(const Vector4f& v0, const Vector4f& v1) {
+#if defined(MATH_SSE)
+	return StoreVector4f(_mm_add_ps(LoadVector4f(v0), LoadVector4f(v1)));
+#elif defined(MATH_NEON)
+	return StoreVector4f(vaddq_f32(LoadVector4f(v0), LoadVector4f(v1)));
+#else
+	return Vector4f(v0.x + v1.x, v0.y + v1.y, v0.z + v1.z, v0.w + v1.w);
+#endif
+}
+
+inline Vector4f operator-(const Vector4f& v0, const Vector4f& v1) {
+#if defined(MATH_SSE)
+	return StoreVector4f(_mm_sub_ps(LoadVector4f(v0), LoadVector4f(v1)));
+#elif defined(MATH_NEON)
+	return StoreVector4f(vsubq_f32(LoadVector4f(v0), LoadVector4f(v1)));
+#else
+	return Vector4f(v0.x - v1.x, v0.y - v1.y, v0.z - v1.z, v0.w - v1.w);
+#endif
+}
+
+inline Vector4f operator*(const float& a, const Vector4f& v) {
+#if defined(MATH_SSE)
+	return StoreVector4f(_mm_mul_ps(_mm_set1_ps(a), LoadVector4f(v)));
+#elif defined(MATH_NEON)
+	return StoreVector4f(vmulq_n_f32(LoadVector4f(v), a));
+#else
+	return Vector4f(a * v.x, a * v.y, a * v.z, a * v.w);
+#endif
+}
+
+inline Vector4f operator*(const Vector4f& v0, const Vector4f& v1) {
+#if defined(MATH_SSE)
+	return StoreVector4f(_mm_mul_ps(LoadVector4f(v0), LoadVector4f(v1)));
+#elif defined(MATH_NEON)
+	return StoreVector4f(vmulq_f32(LoadVector4f(v0), LoadVector4f(v1)));
+#else
+	return Vector4f(v0.x * v1.x, v0.y * v1.y, v0.z * v1.z, v0.w * v1.w);
+#endif
+}
+
+inline Vector4f saturate(const Vector4f& v) {
+	//The constant goes first so NaN passes through, as it does in the scalar saturate
+#if defined(MATH_SSE)
+	__m128 result = _mm_min_ps(_mm_set1_ps(1.0f), LoadVector4f(v));
+	return StoreVector4f(_mm_max_ps(_mm_setzero_ps(), result));
+#else
+	return Vector4f(saturate(v.x), saturate(v.y), saturate(v.z), saturate(v.w));
+#endif
+}
+
+inline Vector4f Lerp(Vector4f v0, Vector4f v1, float percent) {
+	return (1.0f - percent) * v0 + percent * v1;
+}
+
+inline Vector4f PerspectiveCorrectInterpolate(float z1, float z2, float z3, Vector4f n1, Vector4f n2, Vector4f n3, float u, float v) {
+	float zt = 1.0f / ((1.0f - u - v) / z1 + u / z2 + v / z3);
+	Vector4f nt;
+	nt.x = ((1.0f - u - v) / z1 * n1.x + u / z2 * n2.x + v / z3 * n3.x) * zt;
+	nt.y = ((1.0f - u - v) / z1 * n1.y + u / z2 * n2.y + v / z3 * n3.y) * zt;
+	nt.z = ((1.0f - u - v) / z1 * n1.z + u / z2 * n2.z + v / z3 * n3.z) * zt;
+	nt.w = ((1.0f - u - v) / z1 * n1.w + u / z2 * n2.w + v / z3 * n3.w) * zt;
+	return nt;
+}
+
+//Summed left to right, a horizontal add would change the rounding
+inline float Dot(Vector4f v0, Vector4f v1) {
+	return v0.x * v1.x + v0.y * v1.y + v0.z * v1.z + v0.w * v1.w;
+}
 
 struct Vertex {
 	Vector4f position;
@@ -139,6 +317,15 @@ Matrix3x3f operator*(float a, Matrix3x3f m);
 
 Vector3f Multiply(Vector3f v, Matrix3x3f m);
 
+//What a transform is known to be made of, so its inverse can skip the general cofactor expansion.
+//Affine: last column is (0, 0, 0, 1). Rigid: affine with an orthonormal 3x3 part. Rotation: rigid without translation
+enum class TransformType {
+	General = 0,
+	Affine,
+	Rigid,
+	Rotation
+};
+
 struct Matrix4x4f {
 	Matrix4x4f() {}
 	Matrix4x4f(float value) : a1(value), b2(value), c3(value), d4(value) {}
@@ -156,6 +343,13 @@ struct Matrix4x4f {
 	float Determinant()const;
 	Matrix4x4f Adjoint()const;
 	Matrix4x4f Inverse()const;
+	//The caller guarantees the matrix really is of the given type, nothing is checked
+	Matrix4x4f Inverse(TransformType type)const;
+	Matrix4x4f InverseAffine()const;
+	Matrix4x4f InverseRigid()const;
+	Matrix4x4f InverseRotation()const;
+	//The most specific type the matrix satisfies within epsilon
+	TransformType GetTransformType(float epsilon = 1e-5f)const;
 
 	Vector4f GetRowVector1()const { return Vector4f(a1, a2, a3, a4); }
 	Vector4f GetRowVector2()const { return Vector4f(b1, b2, b3, b4); }
@@ -176,8 +370,59 @@ struct Matrix4x4f {
 Matrix4x4f operator+(const Matrix4x4f m0, const Matrix4x4f m1);
 Matrix4x4f operator*(float a, Matrix4x4f m);
 
-Matrix4x4f Multiply(Matrix4x4f m0, Matrix4x4f m1);
-Vector4f Multiply(Vector4f v, Matrix4x4f m);
+//Row vector times matrix, a weighted sum of the rows. Every component is summed in the same order as
+//Dot(v, column), so the SIMD and scalar paths agree
+inline Vector4f Multiply(Vector4f v, Matrix4x4f m) {
+#if defined(MATH_SSE)
+	__m128 result = _mm_mul_ps(_mm_set1_ps(v.x), _mm_loadu_ps(&m.a1));
+	result = _mm_add_ps(result, _mm_mul_ps(_mm_set1_ps(v.y), _mm_loadu_ps(&m.b1)));
+	result = _mm_add_ps(result, _mm_mul_ps(_mm_set1_ps(v.z), _mm_loadu_ps(&m.c1)));
+	result = _mm_add_ps(result, _mm_mul_ps(_mm_set1_ps(v.w), _mm_loadu_ps(&m.d1)));
+	return StoreVector4f(result);
+#elif defined(MATH_NEON)
+	float32x4_t result = vmulq_n_f32(vld1q_f32(&m.a1), v.x);
+	result = vaddq_f32(result, vmulq_n_f32(vld1q_f32(&m.b1), v.y));
+	result = vaddq_f32(result, vmulq_n_f32(vld1q_f32(&m.c1), v.z));
+	result = vaddq_f32(result, vmulq_n_f32(vld1q_f32(&m.d1), v.w));
+	return StoreVector4f(result);
+#else
+	return Vector4f(
+		Dot(v, m.GetColumnVector1()),
+		Dot(v, m.GetColumnVector2()),
+		Dot(v, m.GetColumnVector3()),
+		Dot(v, m.GetColumnVector4())
+	);
+#endif
+}
+
+inline Matrix4x4f Multiply(Matrix4x4f m0, Matrix4x4f m1) {
+	return Matrix4x4f(
+		Multiply(m0.GetRowVector1(), m1),
+		Multiply(m0.GetRowVector2(), m1),
+		Multiply(m0.GetRowVector3(), m1),
+		Multiply(m0.GetRowVector4(), m1)
+	);
+}
+
+struct InstanceData {
+	Matrix4x4f worldMatrix{ Matrix4x4f(1.0f) };
+	Matrix4x4f normalMatrix{ Matrix4x4f(1.0f) };
+	Vector4f color{ Vector4f(1.0f) };
+};
+
+//Inverse transpose of the world matrix for transforming normals. Only the upper 3x3 is meaningful since normals have w = 0,
+//so for rigid and rotation transforms it is the rotation part of the world matrix itself
+Matrix4x4f NormalMatrix(const Matrix4x4f& worldMatrix, TransformType type = TransformType::General);
+
+//Kept per object, the normal matrix is recomputed only when the world matrix or its type changes
+struct NormalMatrixCache {
+	const Matrix4x4f& Get(const Matrix4x4f& worldMatrix, TransformType type = TransformType::General);
+
+	Matrix4x4f worldMatrix;
+	Matrix4x4f normalMatrix{ Matrix4x4f(1.0f) };
+	TransformType type{ TransformType::General };
+	bool valid{ false };
+};
 
 Matrix4x4f Scale(float x, float y, float z);
 
@@ -191,4 +436,22 @@ Matrix4x4f Translate(float x, float y, float z);
 Matrix4x4f OrthograpicProjection(float l, float r, float t, float b, float n, float f);
 Matrix4x4f PerspectiveProjection(float l, float r, float t, float b, float n, float f);
 
-Vector3f CalcBarycentric(Vector2f v0, Vector2f v1, Vector2f v2, Vector2f p);
\ No newline at end of file
+inline Vector3f CalcBarycentric(Vector2f v0, Vector2f v1, Vector2f v2, Vector2f p) {
+	float Ux = v1.x - v0.x;
+	float Uy = v1.y - v0.y;
+	float Vx = v2.x - v0.x;
+	float Vy = v2.y - v0.y;
+	float POx = v0.x - p.x;
+	float POy = v0.y - p.y;
+
+	Vector3f kAB1 = Cross(Vector3f(Ux, Vx, POx), Vector3f(Uy, Vy, POy));
+
+	if (abs(kAB1.z) < 1.0f) {
+		return Vector3f(-1.0f, 1.0f, 1.0f);
+	}
+
+	float A = kAB1.x / kAB1.z;
+	float B = kAB1.y / kAB1.z;
+
+	return Vector3f(1.0f - A - B, A, B);
+}
\ No newline at end of file
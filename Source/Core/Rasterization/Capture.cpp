@@ -0,0 +1,485 @@
+#include "Capture.h"
+#include <chrono>
+#include <cmath>
+
+bool CaptureWriter::Begin(const char* path, const Pipeline& pipeline) {
+	file.open(path, std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) return false;
+
+	CaptureHeader header;
+	header.width = pipeline.GetWidth();
+	header.height = pipeline.GetHeight();
+	header.sampleCount = (uint32_t)pipeline.GetSampleCount();
+	Write(header);
+
+	textureIds.clear();
+	RecordPipelineState(pipeline.GetPipelineState());
+	return true;
+}
+
+void CaptureWriter::End() {
+	if (!file.is_open()) return;
+	Write(CaptureCommand::End);
+	file.close();
+}
+
+void CaptureWriter::RecordClear(Vector4f colorValue, float depthValue, uint8_t stencilValue) {
+	Write(CaptureCommand::Clear);
+	Write(colorValue);
+	Write(depthValue);
+	Write(stencilValue);
+}
+
+int32_t CaptureWriter::RecordTexture(const Texture* texture) {
+	if (!texture) return -1;
+
+	auto it = textureIds.find(texture);
+	if (it != textureIds.end()) return it->second;
+
+	int32_t id = (int32_t)textureIds.size();
+	textureIds[texture] = id;
+
+	uint64_t subresourceCount = texture->GetSubresourceCount();
+	uint64_t residentLevel = texture->GetResidentLevel();
+	Write(CaptureCommand::Texture);
+	Write(id);
+	Write(subresourceCount);
+	Write(residentLevel);
+	//Evicted levels are described but have no data
+	for (size_t i = 0; i < subresourceCount; i++) {
+		auto& image = texture->GetImage(i);
+		Write(image.width);
+		Write(image.height);
+		Write(image.BPP);
+		Write(image.layout);
+		Write(image.format);
+		Write(image.imageSize);
+		if (i >= residentLevel)
+			Write(image.source, image.imageSize);
+	}
+	return id;
+}
+
+void CaptureWriter::RecordShader(const GouraudShader& shader) {
+	//Textures are written before the command that references them
+	int32_t textureId = RecordTexture(shader.texture);
+
+	Write(CaptureCommand::SetShader);
+	Write(shader.passConstant);
+	Write(shader.objectConstant);
+	Write(shader.materialConstant);
+	Write(shader.sampler.GetFilter());
+	Write(shader.sampler.GetAddressModeU());
+	Write(shader.sampler.GetAddressModeV());
+	Write(shader.sampler.GetMipFilter());
+	Write(shader.sampler.GetBorderColor());
+	Write(textureId);
+	Write(shader.precision);
+}
+
+void CaptureWriter::RecordPipelineState(const PipelineState& state) {
+	//Field by field with bools as bytes, so replay can check every value without relying on the struct layout
+	Write(CaptureCommand::SetPipelineState);
+	Write(state.blendState);
+	Write((uint8_t)state.depthState.testEnable);
+	Write((uint8_t)state.depthState.writeEnable);
+	Write(state.depthState.compareFunc);
+	Write((uint8_t)state.stencilState.enable);
+	Write(state.stencilState.readMask);
+	Write(state.stencilState.writeMask);
+	RecordStencilFace(state.stencilState.frontFace);
+	RecordStencilFace(state.stencilState.backFace);
+	Write(state.stencilReference);
+	Write(state.rasterizerState.cullMode);
+	Write(state.rasterizerState.frontFace);
+	Write((uint8_t)state.primitiveRestartEnable);
+	Write(state.viewport);
+	Write(state.scissorRect);
+}
+
+void CaptureWriter::RecordStencilFace(const StencilFaceState& face) {
+	Write(face.failOp);
+	Write(face.depthFailOp);
+	Write(face.passOp);
+	Write(face.compareFunc);
+}
+
+void CaptureWriter::RecordVertices(const InputLayout& layout, size_t firstVertex, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		Write(layout.Fetch(firstVertex + i));
+	}
+}
+
+void CaptureWriter::RecordDraw(TopologyType topologyType, const InputLayout& layout, size_t baseVertex, size_t count) {
+	Write(CaptureCommand::Draw);
+	Write(topologyType);
+	Write((uint64_t)count);
+	RecordVertices(layout, baseVertex, count);
+}
+
+void CaptureWriter::RecordDrawIndexed(TopologyType topologyType, const InputLayout& layout, size_t baseVertex, const uint32_t* indices, size_t count) {
+	if (count == 0) return;
+
+	Write(CaptureCommand::DrawIndexed);
+	Write(topologyType);
+	RecordIndexedData(layout, baseVertex, indices, count);
+}
+
+void CaptureWriter::RecordDrawIndexedInstanced(TopologyType topologyType, const InputLayout& layout, size_t baseVertex, const uint32_t* indices, size_t count, const InstanceData* instances, size_t instanceCount) {
+	if (count == 0) return;
+
+	Write(CaptureCommand::DrawIndexedInstanced);
+	Write(topologyType);
+	RecordIndexedData(layout, baseVertex, indices, count);
+	//Without an instance buffer every instance uses objectConstant, which the shader record carries
+	Write((uint64_t)instanceCount);
+	Write((uint8_t)(instances != nullptr));
+	if (instances) Write(instances, sizeof(InstanceData) * instanceCount);
+}
+
+void CaptureWriter::RecordIndexedData(const InputLayout& layout, size_t baseVertex, const uint32_t* indices, size_t count) {
+	//Only the referenced vertex range is stored, indices are rebased onto it and restart indices are kept as they are
+	uint32_t minIndex = UINT32_MAX, maxIndex = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (indices[i] == UINT32_MAX) continue;
+		minIndex = std::min(minIndex, indices[i]);
+		maxIndex = std::max(maxIndex, indices[i]);
+	}
+	uint64_t vertexCount = minIndex == UINT32_MAX ? 0 : maxIndex - minIndex + 1;
+
+	Write((uint64_t)count);
+	for (size_t i = 0; i < count; i++) {
+		Write(indices[i] == UINT32_MAX ? UINT32_MAX : indices[i] - minIndex);
+	}
+	Write(vertexCount);
+	RecordVertices(layout, baseVertex + minIndex, vertexCount);
+}
+
+void CaptureWriter::RecordMultiDrawIndexedIndirect(TopologyType topologyType, const InputLayout& layout, const uint32_t* indices, const InstanceData* instances,
+	const MaterialBinding* materials, size_t materialBufferCount, const DrawIndexedIndirectArgs* args, size_t drawCount) {
+	//Every buffer is cut down to the range the records reference, the records are rebased onto it.
+	//Draws the pipeline skips for their material are recorded empty
+	auto skipped = [&](const DrawIndexedIndirectArgs& draw) {
+		return draw.indexCount == 0 || draw.instanceCount == 0 || (materials && draw.materialId >= materialBufferCount);
+	};
+	uint32_t minIndex = UINT32_MAX, maxIndex = 0;
+	int64_t minVertex = INT64_MAX, maxVertex = INT64_MIN;
+	uint32_t minInstance = UINT32_MAX, maxInstance = 0;
+	uint32_t materialCount = 0;
+	for (size_t i = 0; i < drawCount; i++) {
+		auto& draw = args[i];
+		if (skipped(draw)) continue;
+
+		minIndex = std::min(minIndex, draw.indexOffset);
+		maxIndex = std::max(maxIndex, draw.indexOffset + draw.indexCount);
+		for (uint32_t j = 0; j < draw.indexCount; j++) {
+			if (indices[draw.indexOffset + j] == UINT32_MAX) continue;
+			int64_t vertex = (int64_t)draw.baseVertex + indices[draw.indexOffset + j];
+			minVertex = std::min(minVertex, vertex);
+			maxVertex = std::max(maxVertex, vertex);
+		}
+		minInstance = std::min(minInstance, draw.baseInstance);
+		maxInstance = std::max(maxInstance, draw.baseInstance + draw.instanceCount);
+		materialCount = std::max(materialCount, draw.materialId + 1);
+	}
+	if (minIndex == UINT32_MAX) return;
+	if (!instances) minInstance = maxInstance = 0;
+	if (!materials) materialCount = 0;
+	if (minVertex > maxVertex) minVertex = 0, maxVertex = -1;
+
+	std::vector<int32_t> textureIds(materialCount);
+	for (uint32_t i = 0; i < materialCount; i++) {
+		textureIds[i] = RecordTexture(materials[i].texture);
+	}
+
+	Write(CaptureCommand::MultiDrawIndexedIndirect);
+	Write(topologyType);
+
+	Write(materialCount);
+	for (uint32_t i = 0; i < materialCount; i++) {
+		Write(materials[i].constant);
+		Write(textureIds[i]);
+	}
+
+	Write((uint64_t)drawCount);
+	for (size_t i = 0; i < drawCount; i++) {
+		DrawIndexedIndirectArgs draw = args[i];
+		if (skipped(draw)) {
+			draw.indexCount = 0;
+		}
+		else {
+			draw.indexOffset -= minIndex;
+			draw.baseVertex = (int32_t)(draw.baseVertex - minVertex);
+			draw.baseInstance -= minInstance;
+		}
+		Write(draw);
+	}
+
+	Write((uint64_t)(maxIndex - minIndex));
+	Write(indices + minIndex, sizeof(uint32_t) * (maxIndex - minIndex));
+	Write((uint64_t)(maxVertex - minVertex + 1));
+	RecordVertices(layout, (size_t)minVertex, (size_t)(maxVertex - minVertex + 1));
+	Write((uint64_t)(maxInstance - minInstance));
+	if (instances) Write(instances + minInstance, sizeof(InstanceData) * (maxInstance - minInstance));
+}
+
+CaptureReader::~CaptureReader() {
+	for (auto& texture : textures) {
+		texture->Release();
+	}
+}
+
+bool CaptureReader::Open(const char* path) {
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file.is_open()) return false;
+
+	data.resize((size_t)file.tellg());
+	file.seekg(0);
+	file.read(data.data(), data.size());
+
+	size_t offset = 0;
+	return Read(header, offset) && header.magic == CaptureHeader().magic && header.version == CaptureHeader().version &&
+		header.width > 0 && header.height > 0 && header.sampleCount <= (uint32_t)SampleCount::Count16;
+}
+
+bool CaptureReader::CheckIndices(const uint32_t* indices, size_t count, int64_t baseVertex, uint64_t vertexCount, bool restart) {
+	for (size_t i = 0; i < count; i++) {
+		if (restart && indices[i] == UINT32_MAX) continue;
+		int64_t vertex = baseVertex + indices[i];
+		if (vertex < 0 || (uint64_t)vertex >= vertexCount) return false;
+	}
+	return true;
+}
+
+bool CaptureReader::CheckImage(const Image& image) {
+	bool compressed = image.format == TextureFormat::BC1 || image.format == TextureFormat::BC3;
+	return image.width > 0 && image.height > 0 &&
+		(uint32_t)image.format <= (uint32_t)TextureFormat::RGB565 && (uint32_t)image.layout <= (uint32_t)TextureLayout::Morton &&
+		(!compressed || image.layout == TextureLayout::Linear) && image.BPP == Texture::GetFormatBPP(image.format) &&
+		image.imageSize == Texture::CalcImageSize(image.width, image.height, image.layout, image.format);
+}
+
+bool CaptureReader::ReadBool(bool& value, size_t& offset)const {
+	uint8_t byte;
+	if (!Read(byte, offset) || byte > 1) return false;
+	value = byte != 0;
+	return true;
+}
+
+bool CaptureReader::ReadStencilFace(StencilFaceState& face, size_t& offset)const {
+	return Read(face.failOp, offset) && Read(face.depthFailOp, offset) && Read(face.passOp, offset) && Read(face.compareFunc, offset) &&
+		face.failOp <= StencilOp::DecrementWrap && face.depthFailOp <= StencilOp::DecrementWrap && face.passOp <= StencilOp::DecrementWrap &&
+		face.compareFunc <= CompareFunc::Always;
+}
+
+bool CaptureReader::ReadPipelineState(PipelineState& state, size_t& offset)const {
+	if (!Read(state.blendState, offset) || !ReadBool(state.depthState.testEnable, offset) || !ReadBool(state.depthState.writeEnable, offset) ||
+		!Read(state.depthState.compareFunc, offset) || !ReadBool(state.stencilState.enable, offset) || !Read(state.stencilState.readMask, offset) ||
+		!Read(state.stencilState.writeMask, offset) || !ReadStencilFace(state.stencilState.frontFace, offset) ||
+		!ReadStencilFace(state.stencilState.backFace, offset) || !Read(state.stencilReference, offset) ||
+		!Read(state.rasterizerState.cullMode, offset) || !Read(state.rasterizerState.frontFace, offset) ||
+		!ReadBool(state.primitiveRestartEnable, offset) || !Read(state.viewport, offset) || !Read(state.scissorRect, offset)) return false;
+
+	//The scissor rectangle is clamped to the framebuffer when applied, so any rectangle is safe
+	const Viewport& viewport = state.viewport;
+	return state.blendState <= BlendState::Premultiplied && state.depthState.compareFunc <= CompareFunc::Always &&
+		state.rasterizerState.cullMode <= CullMode::Back && state.rasterizerState.frontFace <= FrontFace::Clockwise &&
+		std::isfinite(viewport.x) && std::isfinite(viewport.y) && std::isfinite(viewport.width) && std::isfinite(viewport.height) &&
+		viewport.width >= 0.0f && viewport.height >= 0.0f &&
+		viewport.minDepth >= 0.0f && viewport.minDepth <= 1.0f && viewport.maxDepth >= 0.0f && viewport.maxDepth <= 1.0f;
+}
+
+bool CaptureReader::Replay(GouraudShaderPipeline& pipeline, std::vector<ReplayDrawRecord>* records) {
+	size_t offset = sizeof(CaptureHeader);
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<InstanceData> instances;
+
+	while (offset < data.size()) {
+		CaptureCommand command;
+		if (!Read(command, offset)) return false;
+
+		switch (command) {
+		case CaptureCommand::Clear: {
+			Vector4f colorValue;
+			float depthValue;
+			uint8_t stencilValue;
+			if (!Read(colorValue, offset) || !Read(depthValue, offset) || !Read(stencilValue, offset)) return false;
+			pipeline.Clear(colorValue, depthValue, stencilValue);
+			break;
+		}
+
+		case CaptureCommand::Texture: {
+			int32_t id;
+			uint64_t subresourceCount, residentLevel;
+			if (!Read(id, offset) || !Read(subresourceCount, offset) || !Read(residentLevel, offset)) return false;
+
+			//Textures are written in id order and survive between replays, only the first replay uploads them.
+			//Every level describes itself, so the count can not exceed what is left of the data
+			const size_t levelSize = 3 * sizeof(uint32_t) + sizeof(TextureLayout) + sizeof(TextureFormat) + sizeof(uint64_t);
+			if (id < 0 || (size_t)id > textures.size() || subresourceCount == 0 || residentLevel >= subresourceCount ||
+				subresourceCount > (data.size() - offset) / levelSize) return false;
+			bool upload = (size_t)id == textures.size();
+			if (upload) textures.push_back(std::make_unique<Texture>((size_t)subresourceCount));
+			else if (textures[id]->GetSubresourceCount() != subresourceCount) return false;
+
+			for (size_t i = 0; i < subresourceCount; i++) {
+				Image image;
+				if (!Read(image.width, offset) || !Read(image.height, offset) || !Read(image.BPP, offset) ||
+					!Read(image.layout, offset) || !Read(image.format, offset) || !Read(image.imageSize, offset) || !CheckImage(image)) return false;
+				bool resident = i >= residentLevel;
+				if (resident && image.imageSize > data.size() - offset) return false;
+				if (upload) {
+					textures[id]->LoadImageFromMemory(image.width, image.height, image.BPP,
+						resident ? reinterpret_cast<const stbi_uc*>(data.data() + offset) : nullptr, i, image.layout, image.format);
+				}
+				if (resident)
+					offset += (size_t)image.imageSize;
+			}
+			if (upload)
+				textures[id]->Evict((size_t)residentLevel);
+			break;
+		}
+
+		case CaptureCommand::SetShader: {
+			GouraudShader shader;
+			Sampler::Filter filter;
+			Sampler::AddressMode addressModeU, addressModeV;
+			Sampler::MipFilter mipFilter;
+			Vector4f borderColor;
+			int32_t textureId;
+
+			if (!Read(shader.passConstant, offset) || !Read(shader.objectConstant, offset) || !Read(shader.materialConstant, offset) ||
+				!Read(filter, offset) || !Read(addressModeU, offset) || !Read(addressModeV, offset) || !Read(mipFilter, offset) ||
+				!Read(borderColor, offset) || !Read(textureId, offset) || !Read(shader.precision, offset)) return false;
+			if (filter > Sampler::Filter::Linear || addressModeU > Sampler::AddressMode::Border || addressModeV > Sampler::AddressMode::Border ||
+				mipFilter > Sampler::MipFilter::Linear || shader.precision > MathPrecision::Approximate ||
+				textureId < -1 || textureId >= (int32_t)textures.size()) return false;
+
+			shader.sampler = Sampler(filter, addressModeU, addressModeV);
+			shader.sampler.SetMipFilter(mipFilter);
+			shader.sampler.SetBorderColor(borderColor);
+			shader.texture = textureId >= 0 ? textures[textureId].get() : nullptr;
+			pipeline.SetShader(shader);
+			break;
+		}
+
+		case CaptureCommand::SetPipelineState: {
+			PipelineState state;
+			if (!ReadPipelineState(state, offset)) return false;
+			pipeline.SetPipelineState(state);
+			break;
+		}
+
+		case CaptureCommand::Draw:
+		case CaptureCommand::DrawIndexed:
+		case CaptureCommand::DrawIndexedInstanced: {
+			TopologyType topologyType;
+			uint64_t count, vertexCount, instanceCount = 0;
+			uint8_t instanced = 0;
+			if (!Read(topologyType, offset) || !Read(count, offset) || topologyType > TopologyType::TriangleStrip) return false;
+
+			if (command != CaptureCommand::Draw) {
+				if (!ReadArray(indices, count, offset) || !Read(vertexCount, offset)) return false;
+			}
+			else {
+				vertexCount = count;
+			}
+			if (!ReadArray(vertices, vertexCount, offset)) return false;
+
+			if (command == CaptureCommand::DrawIndexedInstanced) {
+				if (!Read(instanceCount, offset) || !Read(instanced, offset) || instanced > 1) return false;
+				if (instanced && !ReadArray(instances, instanceCount, offset)) return false;
+			}
+
+			pipeline.SetTopologyType(topologyType);
+			bool restart = pipeline.GetPipelineState().primitiveRestartEnable &&
+				(topologyType == TopologyType::LineStrip || topologyType == TopologyType::TriangleStrip);
+			if (command != CaptureCommand::Draw && !CheckIndices(indices.data(), indices.size(), 0, vertexCount, restart)) return false;
+			pipeline.SetVertexBuffer(vertices.data());
+			pipeline.SetIndexBuffer(indices.data());
+			pipeline.SetInstanceBuffer(instanced ? instances.data() : nullptr);
+
+			auto start = std::chrono::high_resolution_clock::now();
+			if (command == CaptureCommand::DrawIndexedInstanced)
+				pipeline.DrawIndexedInstanced(count, instanceCount, 0, 0, 0);
+			else if (command == CaptureCommand::DrawIndexed)
+				pipeline.DrawIndexed(0, 0, count);
+			else
+				pipeline.Draw(0, count);
+			auto end = std::chrono::high_resolution_clock::now();
+
+			if (records) {
+				ReplayDrawRecord record;
+				record.command = command;
+				record.topologyType = topologyType;
+				record.count = count;
+				record.milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+				records->push_back(record);
+			}
+			break;
+		}
+
+		case CaptureCommand::MultiDrawIndexedIndirect: {
+			TopologyType topologyType;
+			uint32_t materialCount;
+			uint64_t drawCount, indexCount, vertexCount, instanceCount;
+			if (!Read(topologyType, offset) || topologyType > TopologyType::TriangleStrip) return false;
+
+			if (!Read(materialCount, offset) || materialCount > (data.size() - offset) / (sizeof(MaterialBinding::constant) + sizeof(int32_t))) return false;
+			std::vector<MaterialBinding> materials(materialCount);
+			for (auto& material : materials) {
+				int32_t textureId;
+				if (!Read(material.constant, offset) || !Read(textureId, offset) ||
+					textureId < -1 || textureId >= (int32_t)textures.size()) return false;
+				material.texture = textureId >= 0 ? textures[textureId].get() : nullptr;
+			}
+
+			std::vector<DrawIndexedIndirectArgs> args;
+			if (!Read(drawCount, offset) || !ReadArray(args, drawCount, offset)) return false;
+			if (!Read(indexCount, offset) || !ReadArray(indices, indexCount, offset)) return false;
+			if (!Read(vertexCount, offset) || !ReadArray(vertices, vertexCount, offset)) return false;
+			if (!Read(instanceCount, offset) || !ReadArray(instances, instanceCount, offset)) return false;
+
+			//Each draw has to stay inside the recorded buffers, with no instance buffer every instance uses objectConstant
+			pipeline.SetTopologyType(topologyType);
+			bool restart = pipeline.GetPipelineState().primitiveRestartEnable &&
+				(topologyType == TopologyType::LineStrip || topologyType == TopologyType::TriangleStrip);
+			for (auto& draw : args) {
+				if (draw.indexCount == 0 || draw.instanceCount == 0) continue;
+				if ((uint64_t)draw.indexOffset + draw.indexCount > indexCount ||
+					(instanceCount && (uint64_t)draw.baseInstance + draw.instanceCount > instanceCount) ||
+					(materialCount && draw.materialId >= materialCount) ||
+					!CheckIndices(indices.data() + draw.indexOffset, draw.indexCount, draw.baseVertex, vertexCount, restart)) return false;
+			}
+
+			pipeline.SetVertexBuffer(vertices.data());
+			pipeline.SetIndexBuffer(indices.data());
+			pipeline.SetInstanceBuffer(instanceCount ? instances.data() : nullptr);
+			pipeline.SetMaterialBuffer(materialCount ? materials.data() : nullptr, materialCount);
+
+			auto start = std::chrono::high_resolution_clock::now();
+			pipeline.MultiDrawIndexedIndirect(args.data(), args.size());
+			auto end = std::chrono::high_resolution_clock::now();
+			pipeline.SetMaterialBuffer(nullptr, 0);
+
+			if (records) {
+				ReplayDrawRecord record;
+				record.command = command;
+				record.topologyType = topologyType;
+				record.count = drawCount;
+				record.milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+				records->push_back(record);
+			}
+			break;
+		}
+
+		case CaptureCommand::End:
+			return true;
+
+		default:
+			return false;
+		}
+	}
+	return false;
+}
\ No newline at end of file
@@ -0,0 +1,107 @@
+#pragma once
+#include "Core/Rasterization/Pipeline.h"
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <unordered_map>
+
+//Binary capture of everything a GouraudShaderPipeline consumes during a frame.
+//Buffers are stored by value, so a capture replays without the original application or assets.
+//Vertex streams are gathered into interleaved Vertex records, whatever input layout was bound.
+enum class CaptureCommand : uint32_t {
+	Clear = 0,
+	Texture,
+	SetShader,
+	SetPipelineState,
+	Draw,
+	DrawIndexed,
+	DrawIndexedInstanced,
+	MultiDrawIndexedIndirect,
+	End
+};
+
+struct CaptureHeader {
+	uint32_t magic{ 0x50435253 };          //"SRCP"
+	uint32_t version{ 14 };
+	uint32_t width{ 0 };
+	uint32_t height{ 0 };
+	uint32_t sampleCount{ 0 };
+};
+
+class CaptureWriter {
+public:
+	CaptureWriter() {}
+	~CaptureWriter() { End(); }
+
+	bool Begin(const char* path, const Pipeline& pipeline);
+	void End();
+
+	void RecordClear(Vector4f colorValue, float depthValue, uint8_t stencilValue);
+	void RecordShader(const GouraudShader& shader);
+	void RecordPipelineState(const PipelineState& state);
+	void RecordDraw(TopologyType topologyType, const InputLayout& layout, size_t baseVertex, size_t count);
+	void RecordDrawIndexed(TopologyType topologyType, const InputLayout& layout, size_t baseVertex, const uint32_t* indices, size_t count);
+	void RecordDrawIndexedInstanced(TopologyType topologyType, const InputLayout& layout, size_t baseVertex, const uint32_t* indices, size_t count, const InstanceData* instances, size_t instanceCount);
+	void RecordMultiDrawIndexedIndirect(TopologyType topologyType, const InputLayout& layout, const uint32_t* indices, const InstanceData* instances,
+		const MaterialBinding* materials, size_t materialBufferCount, const DrawIndexedIndirectArgs* args, size_t drawCount);
+
+private:
+	int32_t RecordTexture(const Texture* texture);
+	void RecordStencilFace(const StencilFaceState& face);
+	void RecordIndexedData(const InputLayout& layout, size_t baseVertex, const uint32_t* indices, size_t count);
+	void RecordVertices(const InputLayout& layout, size_t firstVertex, size_t count);
+	void Write(const void* data, size_t size) { file.write(reinterpret_cast<const char*>(data), size); }
+	template<typename T> void Write(const T& value) { Write(&value, sizeof(T)); }
+
+	std::ofstream file;
+	std::unordered_map<const Texture*, int32_t> textureIds;
+};
+
+struct ReplayDrawRecord {
+	CaptureCommand command;
+	TopologyType topologyType;
+	size_t count;
+	double milliseconds;
+};
+
+class CaptureReader {
+public:
+	CaptureReader() {}
+	~CaptureReader();
+
+	bool Open(const char* path);
+	const CaptureHeader& GetHeader()const { return header; }
+
+	//Re-executes the whole command stream, the timing of each draw is appended to records when given.
+	//Every size, id and index is checked against the data before it is used, false on the first one that does not fit
+	bool Replay(GouraudShaderPipeline& pipeline, std::vector<ReplayDrawRecord>* records = nullptr);
+
+private:
+	//False without reading when fewer than sizeof(T) bytes are left
+	template<typename T> bool Read(T& value, size_t& offset)const {
+		if (offset > data.size() || sizeof(T) > data.size() - offset) return false;
+		memcpy(&value, data.data() + offset, sizeof(T));
+		offset += sizeof(T);
+		return true;
+	}
+	//Resizes values to count elements and fills them, false without allocating when fewer than count * sizeof(T) bytes are left
+	template<typename T> bool ReadArray(std::vector<T>& values, uint64_t count, size_t& offset)const {
+		if (offset > data.size() || count > (data.size() - offset) / sizeof(T)) return false;
+		values.resize((size_t)count);
+		if (count) memcpy(values.data(), data.data() + offset, sizeof(T) * (size_t)count);
+		offset += sizeof(T) * (size_t)count;
+		return true;
+	}
+	//Every index, offset by baseVertex, addresses one of vertexCount vertices or restarts the strip
+	static bool CheckIndices(const uint32_t* indices, size_t count, int64_t baseVertex, uint64_t vertexCount, bool restart);
+	static bool CheckImage(const Image& image);
+	//Bytes other than 0 and 1 are rejected
+	bool ReadBool(bool& value, size_t& offset)const;
+	bool ReadStencilFace(StencilFaceState& face, size_t& offset)const;
+	//Every enum has to be in range and the viewport finite with depths in [0, 1]
+	bool ReadPipelineState(PipelineState& state, size_t& offset)const;
+
+	CaptureHeader header;
+	std::vector<char> data;
+	std::vector<std::unique_ptr<Texture>> textures;
+};
\ No newline at end of file
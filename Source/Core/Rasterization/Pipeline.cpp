@@ -1,4 +1,6 @@
 #include "Pipeline.h"
+#include "Capture.h"
+#include "Core/Job/JobSystem.h"
 
 Pipeline::Pipeline(uint32_t width, uint32_t height, SampleCount sampleCount)
 	: width(width), height(height), sampleCount(sampleCount) {
@@ -20,17 +22,28 @@ Pipeline::Pipeline(uint32_t width, uint32_t height, SampleCount sampleCount)
 		break;
 	}
 	zBuffer = new float[width * height * multipleBuffer];
+	stencilBuffer = new uint8_t[width * height * multipleBuffer];
 	framebuffer = new Vector4f[width * height * multipleBuffer];
 	for (int i = 0; i < width * height * multipleBuffer; i++) {
 		zBuffer[i] = FLT_MAX;
+		stencilBuffer[i] = 0;
 		framebuffer[i] = Vector4f(0.0f, 0.0f, 0.0f, 0.0f);
 	}
+
+	state.viewport.width = (float)width;
+	state.viewport.height = (float)height;
+	state.scissorRect.right = width;
+	state.scissorRect.bottom = height;
+	UpdateRasterRegion();
 }
 
-void Pipeline::Clear(Vector4f colorValue, float depthValue) {
+void Pipeline::Clear(Vector4f colorValue, float depthValue, uint8_t stencilValue) {
+	if (capture) capture->RecordClear(colorValue, depthValue, stencilValue);
+
 	for (int i = 0; i < width * height * multipleBuffer; i++) {
 		framebuffer[i] = colorValue;
 		zBuffer[i] = depthValue;
+		stencilBuffer[i] = stencilValue;
 	}
 }
 
@@ -45,81 +58,288 @@ Vector3f Pipeline::ReadFramebuffer(int x, int y) {
 	return 1.0f / multipleBuffer * color;
 }
 
+void Pipeline::SetVertexBuffer(const Vertex* vertexBuffer) {
+	SetVertexStream(VertexAttribute::Position, vertexBuffer ? &vertexBuffer->position : nullptr, sizeof(Vertex));
+	SetVertexStream(VertexAttribute::Color, vertexBuffer ? &vertexBuffer->color : nullptr, sizeof(Vertex));
+	SetVertexStream(VertexAttribute::TexCoord, vertexBuffer ? &vertexBuffer->texCoord : nullptr, sizeof(Vertex));
+	SetVertexStream(VertexAttribute::Normal, vertexBuffer ? &vertexBuffer->normal : nullptr, sizeof(Vertex));
+}
+
+void Pipeline::SetVertexStream(VertexAttribute attribute, const void* data, size_t stride) {
+	inputLayout.streams[(size_t)attribute].data = data;
+	inputLayout.streams[(size_t)attribute].stride = stride;
+}
+
+void Pipeline::SetBlendState(BlendState blendState) {
+	state.blendState = blendState;
+	if (capture) capture->RecordPipelineState(state);
+}
+
+void Pipeline::SetDepthState(DepthState depthState) {
+	state.depthState = depthState;
+	if (capture) capture->RecordPipelineState(state);
+}
+
+void Pipeline::SetStencilState(StencilState stencilState) {
+	state.stencilState = stencilState;
+	if (capture) capture->RecordPipelineState(state);
+}
+
+void Pipeline::SetStencilReference(uint8_t stencilReference) {
+	state.stencilReference = stencilReference;
+	if (capture) capture->RecordPipelineState(state);
+}
+
+void Pipeline::SetRasterizerState(RasterizerState rasterizerState) {
+	state.rasterizerState = rasterizerState;
+	if (capture) capture->RecordPipelineState(state);
+}
+
+void Pipeline::SetPrimitiveRestartEnable(bool primitiveRestartEnable) {
+	state.primitiveRestartEnable = primitiveRestartEnable;
+	if (capture) capture->RecordPipelineState(state);
+}
+
+void Pipeline::SetViewport(Viewport viewport) {
+	state.viewport = viewport;
+	UpdateRasterRegion();
+	if (capture) capture->RecordPipelineState(state);
+}
+
+void Pipeline::SetScissorRect(ScissorRect scissorRect) {
+	state.scissorRect = scissorRect;
+	UpdateRasterRegion();
+	if (capture) capture->RecordPipelineState(state);
+}
+
+void Pipeline::SetPipelineState(const PipelineState& state) {
+	this->state = state;
+	UpdateRasterRegion();
+	if (capture) capture->RecordPipelineState(state);
+}
+
+void Pipeline::UpdateRasterRegion() {
+	const Viewport& viewport = state.viewport;
+	viewportScale = Vector3f(viewport.width / 2.0f, -viewport.height / 2.0f, viewport.maxDepth - viewport.minDepth);
+	viewportBias = Vector3f(viewport.x + viewport.width / 2.0f, viewport.y + viewport.height / 2.0f, viewport.minDepth);
+
+	rasterLeft = std::max(state.scissorRect.left, 0);
+	rasterTop = std::max(state.scissorRect.top, 0);
+	rasterRight = std::min(state.scissorRect.right, (int)width);
+	rasterBottom = std::min(state.scissorRect.bottom, (int)height);
+}
+
+template<typename T>
+static bool Compare(CompareFunc func, T value, T reference) {
+	switch (func) {
+	case CompareFunc::Never: return false;
+	case CompareFunc::Less: return value < reference;
+	case CompareFunc::Equal: return value == reference;
+	case CompareFunc::LessEqual: return value <= reference;
+	case CompareFunc::Greater: return value > reference;
+	case CompareFunc::NotEqual: return value != reference;
+	case CompareFunc::GreaterEqual: return value >= reference;
+	default: return true;
+	}
+}
+
+template<BlendState blendState>
 void Pipeline::WriteFramebuffer(int x, int y, int samplePoint, Vector4f color) {
 	int pos = samplePoint * width * height + y * width + x;
-	color.x = color.x * color.w + framebuffer[pos].x * (1.0f - color.w);
-	color.y = color.y * color.w + framebuffer[pos].y * (1.0f - color.w);
-	color.z = color.z * color.w + framebuffer[pos].z * (1.0f - color.w);
-	color.w = color.w;
+	switch (blendState) {
+	case BlendState::Opaque:
+		break;
+	case BlendState::AlphaBlend: {
+		Vector4f dest = framebuffer[pos];
+		color.x = color.x * color.w + dest.x * (1.0f - color.w);
+		color.y = color.y * color.w + dest.y * (1.0f - color.w);
+		color.z = color.z * color.w + dest.z * (1.0f - color.w);
+		break;
+	}
+	case BlendState::Additive: {
+		Vector4f dest = framebuffer[pos];
+		color.x = min(color.x * color.w + dest.x, 1.0f);
+		color.y = min(color.y * color.w + dest.y, 1.0f);
+		color.z = min(color.z * color.w + dest.z, 1.0f);
+		color.w = dest.w;
+		break;
+	}
+	case BlendState::Premultiplied: {
+		Vector4f dest = framebuffer[pos];
+		color.x = color.x + dest.x * (1.0f - color.w);
+		color.y = color.y + dest.y * (1.0f - color.w);
+		color.z = color.z + dest.z * (1.0f - color.w);
+		color.w = color.w + dest.w * (1.0f - color.w);
+		break;
+	}
+	}
 	framebuffer[pos] = color;
 }
 
+template<CompareFunc depthFunc, bool depthWrite>
 bool Pipeline::DepthTest(int x, int y, int samplePoint, float z) {
-	if (z <= zBuffer[samplePoint * width * height + y * width + x]) {
-		zBuffer[samplePoint * width * height + y * width + x] = z;
+	float* depth = &zBuffer[samplePoint * width * height + y * width + x];
+	bool passed = depthFunc == CompareFunc::Always || Compare(depthFunc, z, *depth);
+	if (depthWrite && passed)
+		*depth = z;
+	return passed;
+}
+
+bool Pipeline::StencilTest(int x, int y, int samplePoint, const StencilFaceState& face) {
+	uint8_t stencil = stencilBuffer[samplePoint * width * height + y * width + x];
+	uint8_t readMask = state.stencilState.readMask;
+	if (Compare(face.compareFunc, (uint8_t)(state.stencilReference & readMask), (uint8_t)(stencil & readMask)))
 		return true;
-	}
+	StencilOperation(x, y, samplePoint, face.failOp);
 	return false;
 }
 
-bool Pipeline::CullFace(Vector2i v0, Vector2i v1, Vector2i v2)const {
-	Vector3f v01 = Vector3f(v1.x - v0.x, v1.y - v0.y, 0.0f);
-	Vector3f v02 = Vector3f(v2.x - v0.x, v2.y - v0.y, 0.0f);
-	Vector3f cross = Cross(v01, v02);
-	if (cross.z > 0.0f)
-		return false;                     //ʱ򣬲޳
-	return true;                          //˳ʱ޳
+void Pipeline::StencilOperation(int x, int y, int samplePoint, StencilOp op) {
+	uint8_t& stencil = stencilBuffer[samplePoint * width * height + y * width + x];
+	uint8_t value = stencil;
+	switch (op) {
+	case StencilOp::Keep: return;
+	case StencilOp::Zero: value = 0; break;
+	case StencilOp::Replace: value = state.stencilReference; break;
+	case StencilOp::IncrementSaturate: value = value == 0xff ? value : value + 1; break;
+	case StencilOp::DecrementSaturate: value = value == 0 ? value : value - 1; break;
+	case StencilOp::Invert: value = ~value; break;
+	case StencilOp::IncrementWrap: value++; break;
+	case StencilOp::DecrementWrap: value--; break;
+	}
+	uint8_t writeMask = state.stencilState.writeMask;
+	stencil = (stencil & ~writeMask) | (value & writeMask);
+}
+
+bool Pipeline::IsFrontFace(Vector2f v0, Vector2f v1, Vector2f v2)const {
+	//Positive area is the counterclockwise winding in screen space
+	float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+	bool counterClockwise = area > 0.0f;
+	return state.rasterizerState.frontFace == FrontFace::CounterClockwise ? counterClockwise : !counterClockwise;
+}
+
+bool Pipeline::CullFace(bool frontFace)const {
+	switch (state.rasterizerState.cullMode) {
+	case CullMode::Front:
+		return frontFace;
+	case CullMode::Back:
+		return !frontFace;
+	default:
+		return false;
+	}
+}
+
+template<BlendState blendState, CompareFunc depthFunc>
+GouraudShaderPipeline::DrawFunction GouraudShaderPipeline::SelectDrawFunction(bool depthWrite)const {
+	return depthWrite ? &GouraudShaderPipeline::DrawData<blendState, depthFunc, true> : &GouraudShaderPipeline::DrawData<blendState, depthFunc, false>;
+}
+
+template<BlendState blendState>
+GouraudShaderPipeline::DrawFunction GouraudShaderPipeline::SelectDrawFunction(CompareFunc depthFunc, bool depthWrite)const {
+	switch (depthFunc) {
+	case CompareFunc::Never: return SelectDrawFunction<blendState, CompareFunc::Never>(depthWrite);
+	case CompareFunc::Less: return SelectDrawFunction<blendState, CompareFunc::Less>(depthWrite);
+	case CompareFunc::Equal: return SelectDrawFunction<blendState, CompareFunc::Equal>(depthWrite);
+	case CompareFunc::LessEqual: return SelectDrawFunction<blendState, CompareFunc::LessEqual>(depthWrite);
+	case CompareFunc::Greater: return SelectDrawFunction<blendState, CompareFunc::Greater>(depthWrite);
+	case CompareFunc::NotEqual: return SelectDrawFunction<blendState, CompareFunc::NotEqual>(depthWrite);
+	case CompareFunc::GreaterEqual: return SelectDrawFunction<blendState, CompareFunc::GreaterEqual>(depthWrite);
+	default: return SelectDrawFunction<blendState, CompareFunc::Always>(depthWrite);
+	}
+}
+
+GouraudShaderPipeline::DrawFunction GouraudShaderPipeline::SelectDrawFunction()const {
+	CompareFunc depthFunc = state.depthState.testEnable ? state.depthState.compareFunc : CompareFunc::Always;
+	bool depthWrite = state.depthState.testEnable && state.depthState.writeEnable;
+
+	switch (state.blendState) {
+	case BlendState::Opaque: return SelectDrawFunction<BlendState::Opaque>(depthFunc, depthWrite);
+	case BlendState::AlphaBlend: return SelectDrawFunction<BlendState::AlphaBlend>(depthFunc, depthWrite);
+	case BlendState::Additive: return SelectDrawFunction<BlendState::Additive>(depthFunc, depthWrite);
+	default: return SelectDrawFunction<BlendState::Premultiplied>(depthFunc, depthWrite);
+	}
+}
+
+void GouraudShaderPipeline::DrawData(const uint32_t* indices, size_t count) {
+	(this->*SelectDrawFunction())(indices, count);
+}
+
+void GouraudShaderPipeline::DecodeIndices(const uint32_t* indices, size_t count, uint32_t& firstVertex, uint32_t& vertexCount) {
+	uint32_t minIndex = UINT32_MAX, maxIndex = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (IsRestartIndex(indices[i])) continue;
+		minIndex = std::min(minIndex, indices[i]);
+		maxIndex = std::max(maxIndex, indices[i]);
+	}
+	firstVertex = minIndex == UINT32_MAX ? 0 : minIndex;
+	vertexCount = minIndex == UINT32_MAX ? 0 : maxIndex - minIndex + 1;
+
+	assemblyIndices.resize(count);
+	for (size_t i = 0; i < count; i++) {
+		assemblyIndices[i] = IsRestartIndex(indices[i]) ? UINT32_MAX : indices[i] - firstVertex;
+	}
 }
 
-Matrix4x4f Pipeline::ScreenSpaceMatrix()const {
-	return Matrix4x4f(
-		Vector4f(width / 2.0f, 0.0f, 0.0f, 0.0f),
-		Vector4f(0.0f, -(int)height / 2.0f, 0.0f, 0.0f),
-		Vector4f(0.0f, 0.0f, 1.0f, 0.0f),
-		Vector4f(width / 2.0f, height / 2.0f, 0.0f, 1.0f)
-	);
+void GouraudShaderPipeline::VertexStage(size_t firstVertex, size_t count) {
+	statistics.vertexShaderInvocations += count;
+	transformedPositions.resize(count);
+	transformedOutputs.resize(count);
+
+	auto shade = [&](size_t begin, size_t end) {
+		shader.VertexShader(inputLayout, firstVertex + begin, end - begin, transformedPositions.data() + begin, transformedOutputs.data() + begin);
+	};
+	if (count >= parallelVertexCount) JobSystem::Get().ParallelFor(count, vertexJobSize, shade);
+	else shade(0, count);
 }
 
-void GouraudShaderPipeline::DrawData(Vertex** vertices, size_t count) {
+template<BlendState blendState, CompareFunc depthFunc, bool depthWrite>
+void GouraudShaderPipeline::DrawData(const uint32_t* indices, size_t count) {
+	//Points and lines always use the front face stencil state
+	bool stencilEnable = state.stencilState.enable;
+	StencilFaceState stencilFace = state.stencilState.frontFace;
+
 	switch (topologyType) {
 	case TopologyType::PointList: {
+		statistics.inputPrimitives += count;
 		for (size_t i = 0; i < count; i++) {
-			GouraudShader::FragmentInput fragmentInput;
-			Vector4f position = shader.VertexShader(shader.InputAssembler(vertices[i]), fragmentInput);
-
-			position.x /= position.w;
-			position.y /= position.w;
-			position.z /= position.w;
-			position.w = 1.0f;
-			position = Multiply(position, ScreenSpaceMatrix());
+			GouraudShader::FragmentInput fragmentInput = transformedOutputs[indices[i]];
+			Vector4f position = ViewportTransform(transformedPositions[indices[i]]);
 
-			uint32_t x = position.x + 0.5f, y = position.y + 0.5f;
-			if (x >= width || x < 0 || y >= height || y < 0)return;
+			int x = position.x + 0.5f, y = position.y + 0.5f;
+			if (x >= rasterRight || x < rasterLeft || y >= rasterBottom || y < rasterTop) continue;
 			float depth = position.z;
 
-			//DepthTest
-			if (!DepthTest(x, y, 0, depth)) continue;
+			//StencilTest and DepthTest
+			if (stencilEnable && !StencilTest(x, y, 0, stencilFace)) continue;
+			if (!DepthTest<depthFunc, depthWrite>(x, y, 0, depth)) {
+				if (stencilEnable) StencilOperation(x, y, 0, stencilFace.depthFailOp);
+				continue;
+			}
+			if (stencilEnable) StencilOperation(x, y, 0, stencilFace.passOp);
 
-			WriteFramebuffer(x, y, 0, shader.FragmentShader(fragmentInput));
+			statistics.fragmentShaderInvocations++;
+			WriteFramebuffer<blendState>(x, y, 0, shader.FragmentShader(fragmentInput));
 		}
 		break;
 	}
 
 	case TopologyType::LineList:
 	case TopologyType::LineStrip: {
-		for (size_t i = 0; i < count / 2; i++) {
-			GouraudShader::FragmentInput fragmentInput[2];
+		//Strips advance by one vertex, a restart index breaks every segment touching it
+		size_t stride = topologyType == TopologyType::LineStrip ? 1 : 2;
+		for (size_t i = 0; i + 1 < count; i += stride) {
+			if (indices[i] == UINT32_MAX || indices[i + 1] == UINT32_MAX) continue;
+			statistics.inputPrimitives++;
 
+			GouraudShader::FragmentInput fragmentInput[2];
 			Vector4f position[2];
-			position[0] = shader.VertexShader(shader.InputAssembler(vertices[i * 2]), fragmentInput[0]);
-			position[1] = shader.VertexShader(shader.InputAssembler(vertices[i * 2 + 1]), fragmentInput[1]);
+			for (size_t j = 0; j < 2; j++) {
+				position[j] = transformedPositions[indices[i + j]];
+				fragmentInput[j] = transformedOutputs[indices[i + j]];
+			}
 
 			for (auto& p : position) {
-				p.x /= p.w;
-				p.y /= p.w;
-				p.z /= p.w;
-				p.w = 1.0f;
-				p = Multiply(p, ScreenSpaceMatrix());
+				p = ViewportTransform(p);
 			}
 
 			int x0 = position[0].x + 0.5f, y0 = position[0].y + 0.5f;
@@ -163,15 +383,21 @@ void GouraudShaderPipeline::DrawData(Vertex** vertices, size_t count) {
 
 					float lerpPercent = (float)(x - x0) / (float)(x1 - x0);
 
-					if (x >= width || x < 0 || y >= height || y < 0) continue;
-					if (!DepthTest(x, y, 0, Lerp(z0, z1, lerpPercent))) continue;
+					if (x >= rasterRight || x < rasterLeft || y >= rasterBottom || y < rasterTop) continue;
+					if (stencilEnable && !StencilTest(x, y, 0, stencilFace)) continue;
+					if (!DepthTest<depthFunc, depthWrite>(x, y, 0, Lerp(z0, z1, lerpPercent))) {
+						if (stencilEnable) StencilOperation(x, y, 0, stencilFace.depthFailOp);
+						continue;
+					}
+					if (stencilEnable) StencilOperation(x, y, 0, stencilFace.passOp);
 
 					GouraudShader::FragmentInput finalInput;
 					finalInput.worldPos = Lerp(fragmentInput[0].worldPos, fragmentInput[1].worldPos, lerpPercent);
 					finalInput.texCoord = Lerp(fragmentInput[0].texCoord, fragmentInput[1].texCoord, lerpPercent);
 					finalInput.normal = Lerp(fragmentInput[0].normal, fragmentInput[1].normal, lerpPercent);
 
-				    WriteFramebuffer(x, y, 0, shader.FragmentShader(finalInput));
+					statistics.fragmentShaderInvocations++;
+				    WriteFramebuffer<blendState>(x, y, 0, shader.FragmentShader(finalInput));
 				}
 			}
 			else {
@@ -193,46 +419,97 @@ void GouraudShaderPipeline::DrawData(Vertex** vertices, size_t count) {
 
 					float lerpPercent = (float)(y - y0) / (float)(y1 - y0);
 
-					if (x >= width || x < 0 || y >= height || y < 0) continue;
-					if (!DepthTest(x, y, 0, Lerp(z0, z1, lerpPercent))) continue;
+					if (x >= rasterRight || x < rasterLeft || y >= rasterBottom || y < rasterTop) continue;
+					if (stencilEnable && !StencilTest(x, y, 0, stencilFace)) continue;
+					if (!DepthTest<depthFunc, depthWrite>(x, y, 0, Lerp(z0, z1, lerpPercent))) {
+						if (stencilEnable) StencilOperation(x, y, 0, stencilFace.depthFailOp);
+						continue;
+					}
+					if (stencilEnable) StencilOperation(x, y, 0, stencilFace.passOp);
 
 					GouraudShader::FragmentInput finalInput;
 					finalInput.worldPos = Lerp(fragmentInput[0].worldPos, fragmentInput[1].worldPos, lerpPercent);
 					finalInput.texCoord = Lerp(fragmentInput[0].texCoord, fragmentInput[1].texCoord, lerpPercent);
 					finalInput.normal = Lerp(fragmentInput[0].normal, fragmentInput[1].normal, lerpPercent);
 
-					WriteFramebuffer(x, y, 0, shader.FragmentShader(finalInput));
+					statistics.fragmentShaderInvocations++;
+					WriteFramebuffer<blendState>(x, y, 0, shader.FragmentShader(finalInput));
 				}
 			}
 		}
 		break;
 	}
 
-	case TopologyType::TriangleList: {
-		for (size_t i = 0; i < count / 3; i++) {
-			GouraudShader::FragmentInput fragmentInput[3];
+	case TopologyType::TriangleList:
+	case TopologyType::TriangleStrip: {
+		bool strip = topologyType == TopologyType::TriangleStrip;
+		size_t stride = strip ? 1 : 3;
+		size_t stripStart = 0;
+		for (size_t i = 0; i + 2 < count; i += stride) {
+			//A restart index ends the strip, the next one starts right after it
+			if (strip) {
+				size_t restart = SIZE_MAX;
+				for (size_t j = i; j < i + 3; j++) {
+					if (indices[j] == UINT32_MAX) restart = j;
+				}
+				if (restart != SIZE_MAX) {
+					i = restart;
+					stripStart = restart + 1;
+					continue;
+				}
+			}
+			statistics.inputPrimitives++;
+
+			//Every odd triangle of a strip swaps its first two vertices to keep the winding of the first one
+			size_t order[3] = { i, i + 1, i + 2 };
+			if (strip && ((i - stripStart) & 1)) std::swap(order[0], order[1]);
 
+			GouraudShader::FragmentInput fragmentInput[3];
 			Vector4f position[3];
-			position[0] = shader.VertexShader(shader.InputAssembler(vertices[i * 3]), fragmentInput[0]);
-			position[1] = shader.VertexShader(shader.InputAssembler(vertices[i * 3 + 1]), fragmentInput[1]);
-			position[2] = shader.VertexShader(shader.InputAssembler(vertices[i * 3 + 2]), fragmentInput[2]);
+			for (size_t j = 0; j < 3; j++) {
+				position[j] = transformedPositions[indices[order[j]]];
+				fragmentInput[j] = transformedOutputs[indices[order[j]]];
+			}
 
 			float worldZ[3];
 
 			for (size_t j = 0; j < 3; j++) {
 				worldZ[j] = position[j].z;
-				position[j].x /= position[j].w;
-				position[j].y /= position[j].w;
-				position[j].z /= position[j].w;
-				position[j].w = 1.0f;
+				position[j] = ViewportTransform(position[j]);
+			}
 
-				position[j] = Multiply(position[j], ScreenSpaceMatrix());
+			//Culled before any setup work is spent on the triangle
+			bool frontFace = IsFrontFace(Vector2f(position[0].x, position[0].y), Vector2f(position[1].x, position[1].y), Vector2f(position[2].x, position[2].y));
+			if (CullFace(frontFace)) {
+				statistics.culledPrimitives++;
+				continue;
 			}
 
 			int x0 = position[0].x + 0.5f, y0 = position[0].y + 0.5f;
 			int x1 = position[1].x + 0.5f, y1 = position[1].y + 0.5f;
 			int x2 = position[2].x + 0.5f, y2 = position[2].y + 0.5f;
 
+			if (stencilEnable)
+				stencilFace = frontFace ? state.stencilState.frontFace : state.stencilState.backFace;
+
+			//texCoord = N / Q with Q = sum(mass / z) and N = sum(mass * texCoord / z), both affine in screen space,
+			//so d(texCoord) = (dN - texCoord * dQ) / Q gives the derivatives for mip selection without neighbouring fragments
+			Vector2f edge1(position[1].x - position[0].x, position[1].y - position[0].y);
+			Vector2f edge2(position[2].x - position[0].x, position[2].y - position[0].y);
+			float area = edge1.x * edge2.y - edge2.x * edge1.y;
+			float massDx[2] = { edge2.y / area, -edge1.y / area };
+			float massDy[2] = { -edge2.x / area, edge1.x / area };
+			float qStep[2] = { 1.0f / worldZ[1] - 1.0f / worldZ[0], 1.0f / worldZ[2] - 1.0f / worldZ[0] };
+			Vector2f nStep[2];
+			for (size_t j = 0; j < 2; j++) {
+				nStep[j].x = fragmentInput[j + 1].texCoord.x / worldZ[j + 1] - fragmentInput[0].texCoord.x / worldZ[0];
+				nStep[j].y = fragmentInput[j + 1].texCoord.y / worldZ[j + 1] - fragmentInput[0].texCoord.y / worldZ[0];
+			}
+			float qDx = massDx[0] * qStep[0] + massDx[1] * qStep[1];
+			float qDy = massDy[0] * qStep[0] + massDy[1] * qStep[1];
+			Vector2f nDx(massDx[0] * nStep[0].x + massDx[1] * nStep[1].x, massDx[0] * nStep[0].y + massDx[1] * nStep[1].y);
+			Vector2f nDy(massDy[0] * nStep[0].x + massDy[1] * nStep[1].x, massDy[0] * nStep[0].y + massDy[1] * nStep[1].y);
+
 			int minX = x0, minY = y0, maxX = x0, maxY = y0;
 
 			if (x1 < minX) minX = x1;
@@ -245,6 +522,13 @@ void GouraudShaderPipeline::DrawData(Vertex** vertices, size_t count) {
 			if (x2 > maxX) maxX = x2;
 			if (y2 > maxY) maxY = y2;
 
+			//Nothing outside the scissor is ever visited
+			minX = std::max(minX, rasterLeft);
+			minY = std::max(minY, rasterTop);
+			maxX = std::min(maxX, rasterRight - 1);
+			maxY = std::min(maxY, rasterBottom - 1);
+			if (minX > maxX || minY > maxY) continue;
+
 			std::vector<Vector2f> offsets;
 			switch (sampleCount) {
 			case SampleCount::Count1: {
@@ -315,20 +599,30 @@ void GouraudShaderPipeline::DrawData(Vertex** vertices, size_t count) {
 
 						Vector3f mass = CalcBarycentric(Vector2f(x0, y0), Vector2f(x1, y1), Vector2f(x2, y2), coord);
 						if (mass.x >= -1e-5f && mass.y >= -1e-5f && mass.z >= -1e-5f) {
+							if (stencilEnable && !StencilTest(x, y, sample, stencilFace)) continue;
+
 							float depth = mass.x * position[0].z + mass.y * position[1].z + mass.z * position[2].z;
-							if (!DepthTest(x, y, sample, depth)) continue;
+							if (!DepthTest<depthFunc, depthWrite>(x, y, sample, depth)) {
+								if (stencilEnable) StencilOperation(x, y, sample, stencilFace.depthFailOp);
+								continue;
+							}
+							if (stencilEnable) StencilOperation(x, y, sample, stencilFace.passOp);
 
 							if (!detected) {
 								GouraudShader::FragmentInput finalInput;
 								finalInput.worldPos = PerspectiveCorrectInterpolate(worldZ[0], worldZ[1], worldZ[2], fragmentInput[0].worldPos, fragmentInput[1].worldPos, fragmentInput[2].worldPos, mass.y, mass.z);
 								finalInput.texCoord = PerspectiveCorrectInterpolate(worldZ[0], worldZ[1], worldZ[2], fragmentInput[0].texCoord, fragmentInput[1].texCoord, fragmentInput[2].texCoord, mass.y, mass.z);
 								finalInput.normal = PerspectiveCorrectInterpolate(worldZ[0], worldZ[1], worldZ[2], fragmentInput[0].normal, fragmentInput[1].normal, fragmentInput[2].normal, mass.y, mass.z);
+								float q = (1.0f - mass.y - mass.z) / worldZ[0] + mass.y / worldZ[1] + mass.z / worldZ[2];
+								finalInput.texCoordDdx = Vector2f((nDx.x - finalInput.texCoord.x * qDx) / q, (nDx.y - finalInput.texCoord.y * qDx) / q);
+								finalInput.texCoordDdy = Vector2f((nDy.x - finalInput.texCoord.x * qDy) / q, (nDy.y - finalInput.texCoord.y * qDy) / q);
 								finalColor = shader.FragmentShader(finalInput);
+								statistics.fragmentShaderInvocations++;
 
 								detected = true;
 							}
 
-							WriteFramebuffer(x, y, sample, finalColor);
+							WriteFramebuffer<blendState>(x, y, sample, finalColor);
 						}
 					}
 				}
@@ -339,18 +633,137 @@ void GouraudShaderPipeline::DrawData(Vertex** vertices, size_t count) {
 	}
 }
 
+void GouraudShaderPipeline::SetShader(GouraudShader shader) {
+	if (capture) capture->RecordShader(shader);
+	this->shader = shader;
+	this->shader.SetupConstants();
+}
+
 void GouraudShaderPipeline::Draw(size_t baseVertexOffset, size_t count) {
-	std::vector<Vertex*> vertices;
+	if (capture) capture->RecordDraw(topologyType, inputLayout, baseVertexOffset, count);
+	statistics.drawCalls++;
+	statistics.inputVertices += count;
+
+	assemblyIndices.resize(count);
 	for (size_t i = 0; i < count; i++) {
-		vertices.push_back(&vertexBuffer[baseVertexOffset + i]);
+		assemblyIndices[i] = (uint32_t)i;
 	}
-	DrawData(vertices.data(), vertices.size());
+	VertexStage(baseVertexOffset, count);
+	DrawData(assemblyIndices.data(), count);
 }
 
 void GouraudShaderPipeline::DrawIndexed(size_t indexOffset, size_t baseVertexOffset, size_t count) {
-	std::vector<Vertex*> vertices;
-	for (size_t i = 0; i < count; i++) {
-		vertices.push_back(&vertexBuffer[baseVertexOffset + indexBuffer[indexOffset + i]]);
+	if (capture) capture->RecordDrawIndexed(topologyType, inputLayout, baseVertexOffset, indexBuffer + indexOffset, count);
+	statistics.drawCalls++;
+	statistics.inputVertices += count;
+
+	uint32_t firstVertex, vertexCount;
+	DecodeIndices(indexBuffer + indexOffset, count, firstVertex, vertexCount);
+	VertexStage(baseVertexOffset + firstVertex, vertexCount);
+	DrawData(assemblyIndices.data(), count);
+}
+
+bool GouraudShaderPipeline::CullInstance(const Vector3f& boundsMin, const Vector3f& boundsMax, const Matrix4x4f& worldMatrix)const {
+	Matrix4x4f worldViewProjMatrix = Multiply(Multiply(worldMatrix, shader.passConstant.viewMatrix), shader.passConstant.projMatrix);
+
+	//Clip space w is the view space z, which is negative in front of the camera,
+	//so a visible point satisfies w <= x <= -w and w <= y <= -w
+	uint32_t outside[5] = { 0, 0, 0, 0, 0 };
+	for (uint32_t corner = 0; corner < 8; corner++) {
+		Vector4f position(
+			corner & 1 ? boundsMax.x : boundsMin.x,
+			corner & 2 ? boundsMax.y : boundsMin.y,
+			corner & 4 ? boundsMax.z : boundsMin.z,
+			1.0f
+		);
+		position = Multiply(position, worldViewProjMatrix);
+		if (position.x < position.w) outside[0]++;
+		if (position.x > -position.w) outside[1]++;
+		if (position.y < position.w) outside[2]++;
+		if (position.y > -position.w) outside[3]++;
+		if (position.w >= 0.0f) outside[4]++;
+	}
+	for (auto& count : outside) {
+		if (count == 8) return true;
+	}
+	return false;
+}
+
+void GouraudShaderPipeline::DrawIndexedInstanced(size_t indexCount, size_t instanceCount, size_t indexOffset, size_t baseVertexOffset, size_t baseInstance) {
+	if (capture) capture->RecordDrawIndexedInstanced(topologyType, inputLayout, baseVertexOffset, indexBuffer + indexOffset, indexCount,
+		instanceBuffer ? instanceBuffer + baseInstance : nullptr, instanceCount);
+	statistics.drawCalls++;
+
+	DrawInstances(indexBuffer + indexOffset, indexCount, baseVertexOffset, instanceBuffer ? instanceBuffer + baseInstance : nullptr, instanceCount);
+
+	//Plain draws keep using objectConstant
+	shader.SetupConstants();
+}
+
+void GouraudShaderPipeline::MultiDrawIndexedIndirect(const DrawIndexedIndirectArgs* args, size_t drawCount) {
+	if (capture) capture->RecordMultiDrawIndexedIndirect(topologyType, inputLayout, indexBuffer, instanceBuffer, materialBuffer, materialCount, args, drawCount);
+	statistics.drawCalls++;
+
+	auto materialConstant = shader.materialConstant;
+	Texture* texture = shader.texture;
+
+	//The bound material carries over between draws
+	uint32_t boundMaterial = UINT32_MAX;
+
+	for (size_t i = 0; i < drawCount; i++) {
+		const DrawIndexedIndirectArgs& draw = args[i];
+		if (draw.indexCount == 0 || draw.instanceCount == 0) continue;
+		if (materialBuffer && draw.materialId >= materialCount) continue;
+
+		if (materialBuffer && draw.materialId != boundMaterial) {
+			const MaterialBinding& material = materialBuffer[draw.materialId];
+			shader.materialConstant.diffuseAlbedo = material.constant.diffuseAlbedo;
+			shader.materialConstant.fresnelR0 = material.constant.fresnelR0;
+			shader.materialConstant.roughness = material.constant.roughness;
+			shader.texture = material.texture;
+			boundMaterial = draw.materialId;
+		}
+
+		DrawInstances(indexBuffer + draw.indexOffset, draw.indexCount, draw.baseVertex,
+			instanceBuffer ? instanceBuffer + draw.baseInstance : nullptr, draw.instanceCount);
+	}
+
+	shader.materialConstant = materialConstant;
+	shader.texture = texture;
+	shader.SetupConstants();
+}
+
+void GouraudShaderPipeline::DrawInstances(const uint32_t* indices, size_t indexCount, int64_t baseVertex, const InstanceData* instances, size_t instanceCount) {
+	if (indexCount == 0) return;
+
+	//Index decoding and the object space bounds of the referenced range are shared by all instances
+	uint32_t firstVertex, vertexCount;
+	DecodeIndices(indices, indexCount, firstVertex, vertexCount);
+	size_t vertexStart = (size_t)(baseVertex + firstVertex);
+
+	Vector3f boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+	const VertexStream& positionStream = inputLayout.GetStream(VertexAttribute::Position);
+	for (size_t i = 0; i < vertexCount; i++) {
+		Vector4f position = positionStream.data ? positionStream.Get<Vector4f>(vertexStart + i) : Vector4f(0.0f, 0.0f, 0.0f, 1.0f);
+		boundsMin = Vector3f(min(boundsMin.x, position.x), min(boundsMin.y, position.y), min(boundsMin.z, position.z));
+		boundsMax = Vector3f(max(boundsMax.x, position.x), max(boundsMax.y, position.y), max(boundsMax.z, position.z));
+	}
+
+	//Without an instance buffer every instance uses objectConstant
+	InstanceData objectInstance;
+	objectInstance.worldMatrix = shader.objectConstant.worldMatrix;
+	objectInstance.normalMatrix = shader.objectConstant.normalMatrix;
+
+	for (size_t i = 0; i < instanceCount; i++) {
+		const InstanceData& instance = instances ? instances[i] : objectInstance;
+		if (CullInstance(boundsMin, boundsMax, instance.worldMatrix)) {
+			statistics.culledInstances++;
+			continue;
+		}
+
+		statistics.inputVertices += indexCount;
+		shader.SetInstance(instance);
+		VertexStage(vertexStart, vertexCount);
+		DrawData(assemblyIndices.data(), indexCount);
 	}
-	DrawData(vertices.data(), vertices.size());
 }
\ No newline at end of file
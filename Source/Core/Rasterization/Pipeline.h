@@ -17,45 +17,250 @@ enum class SampleCount {
 	Count16
 };
 
+enum class BlendState {
+	Opaque = 0,                            //never reads the framebuffer
+	AlphaBlend,
+	Additive,
+	Premultiplied
+};
+
+enum class CompareFunc {
+	Never = 0,
+	Less,
+	Equal,
+	LessEqual,
+	Greater,
+	NotEqual,
+	GreaterEqual,
+	Always
+};
+
+struct DepthState {
+	bool testEnable{ true };               //a disabled test also disables depth writes
+	bool writeEnable{ true };
+	CompareFunc compareFunc{ CompareFunc::LessEqual };
+};
+
+enum class StencilOp {
+	Keep = 0,
+	Zero,
+	Replace,
+	IncrementSaturate,
+	DecrementSaturate,
+	Invert,
+	IncrementWrap,
+	DecrementWrap
+};
+
+struct StencilFaceState {
+	StencilOp failOp{ StencilOp::Keep };
+	StencilOp depthFailOp{ StencilOp::Keep };
+	StencilOp passOp{ StencilOp::Keep };
+	CompareFunc compareFunc{ CompareFunc::Always };
+};
+
+//The test compares (reference & readMask) against (stencil & readMask)
+struct StencilState {
+	bool enable{ false };
+	uint8_t readMask{ 0xff };
+	uint8_t writeMask{ 0xff };
+	StencilFaceState frontFace;
+	StencilFaceState backFace;
+};
+
+enum class CullMode {
+	None = 0,
+	Front,
+	Back
+};
+
+//Windings are in screen space
+enum class FrontFace {
+	CounterClockwise = 0,
+	Clockwise
+};
+
+struct RasterizerState {
+	CullMode cullMode{ CullMode::None };
+	FrontFace frontFace{ FrontFace::CounterClockwise };
+};
+
+struct Viewport {
+	float x{ 0.0f }, y{ 0.0f };
+	float width{ 0.0f }, height{ 0.0f };
+	float minDepth{ 0.0f }, maxDepth{ 1.0f };
+};
+
+//Right and bottom are exclusive
+struct ScissorRect {
+	int left{ 0 }, top{ 0 };
+	int right{ 0 }, bottom{ 0 };
+};
+
+struct PipelineState {
+	BlendState blendState{ BlendState::AlphaBlend };
+	DepthState depthState;
+	StencilState stencilState;
+	uint8_t stencilReference{ 0 };
+	RasterizerState rasterizerState;
+	bool primitiveRestartEnable{ false };  //an index of UINT32_MAX ends the current strip
+	Viewport viewport;                     //both cover the whole framebuffer by default
+	ScissorRect scissorRect;
+};
+
+struct PipelineStatistics {
+	uint64_t drawCalls{ 0 };
+	uint64_t inputVertices{ 0 };
+	uint64_t inputPrimitives{ 0 };
+	uint64_t vertexShaderInvocations{ 0 };
+	uint64_t fragmentShaderInvocations{ 0 };
+	uint64_t culledInstances{ 0 };
+	uint64_t culledPrimitives{ 0 };
+};
+
+//One record of a MultiDrawIndexedIndirect argument buffer
+struct DrawIndexedIndirectArgs {
+	uint32_t indexCount{ 0 };
+	uint32_t instanceCount{ 1 };
+	uint32_t indexOffset{ 0 };
+	int32_t baseVertex{ 0 };
+	uint32_t baseInstance{ 0 };
+	uint32_t materialId{ 0 };
+};
+
+struct MaterialBinding {
+	Material constant;
+	Texture* texture{ nullptr };
+};
+
+class CaptureWriter;
+
 class Pipeline {
 public:
 	Pipeline(uint32_t width, uint32_t height, SampleCount sampleCount);
-	~Pipeline() { delete[] zBuffer; delete[] framebuffer; }
+	~Pipeline() { delete[] zBuffer; delete[] stencilBuffer; delete[] framebuffer; }
 
-	void SetVertexBuffer(Vertex* vertexBuffer) { this->vertexBuffer = vertexBuffer; }
+	//Binds every attribute stream to one array of interleaved Vertex records
+	void SetVertexBuffer(const Vertex* vertexBuffer);
+	void SetVertexStream(VertexAttribute attribute, const void* data, size_t stride);
+	void SetInputLayout(const InputLayout& inputLayout) { this->inputLayout = inputLayout; }
+	const InputLayout& GetInputLayout()const { return inputLayout; }
 	void SetIndexBuffer(uint32_t* indexBuffer) { this->indexBuffer = indexBuffer; }
+	void SetInstanceBuffer(InstanceData* instanceBuffer) { this->instanceBuffer = instanceBuffer; }
 	void SetTopologyType(TopologyType topologyType) { this->topologyType = topologyType; }
 
-	void Clear(Vector4f colorValue, float depthValue);
+	void SetBlendState(BlendState blendState);
+	void SetDepthState(DepthState depthState);
+	void SetStencilState(StencilState stencilState);
+	void SetStencilReference(uint8_t stencilReference);
+	void SetRasterizerState(RasterizerState rasterizerState);
+	void SetPrimitiveRestartEnable(bool primitiveRestartEnable);
+	void SetViewport(Viewport viewport);
+	void SetScissorRect(ScissorRect scissorRect);
+	void SetPipelineState(const PipelineState& state);
+	const PipelineState& GetPipelineState()const { return state; }
+
+	void Clear(Vector4f colorValue, float depthValue, uint8_t stencilValue = 0);
 	Vector3f ReadFramebuffer(int x, int y);
 
+	uint32_t GetWidth()const { return width; }
+	uint32_t GetHeight()const { return height; }
+	SampleCount GetSampleCount()const { return sampleCount; }
+
+	//Every call is recorded into the capture until it is set back to nullptr
+	void SetCapture(CaptureWriter* capture) { this->capture = capture; }
+
+	const PipelineStatistics& GetStatistics()const { return statistics; }
+	void ResetStatistics() { statistics = PipelineStatistics(); }
+
 protected:
-	void WriteFramebuffer(int x, int y, int samplePoint, Vector4f color);
-	bool DepthTest(int x, int y, int samplePoint, float z);
-	bool CullFace(Vector2i v0, Vector2i v1, Vector2i v2)const;
+	template<BlendState blendState> void WriteFramebuffer(int x, int y, int samplePoint, Vector4f color);
+	template<CompareFunc depthFunc, bool depthWrite> bool DepthTest(int x, int y, int samplePoint, float z);
+	//Runs before depth interpolation, a failing sample has failOp applied and is discarded
+	bool StencilTest(int x, int y, int samplePoint, const StencilFaceState& face);
+	void StencilOperation(int x, int y, int samplePoint, StencilOp op);
+	bool IsFrontFace(Vector2f v0, Vector2f v1, Vector2f v2)const;
+	bool CullFace(bool frontFace)const;
+	//Restart only applies to strip topologies
+	bool IsRestartIndex(uint32_t index)const {
+		return index == UINT32_MAX && state.primitiveRestartEnable &&
+			(topologyType == TopologyType::LineStrip || topologyType == TopologyType::TriangleStrip);
+	}
 
-	Matrix4x4f ScreenSpaceMatrix()const;
+	//Perspective divide followed by the viewport scale and bias
+	Vector4f ViewportTransform(Vector4f position)const {
+		float invW = 1.0f / position.w;
+		return Vector4f(
+			position.x * invW * viewportScale.x + viewportBias.x,
+			position.y * invW * viewportScale.y + viewportBias.y,
+			position.z * invW * viewportScale.z + viewportBias.z,
+			1.0f
+		);
+	}
+	void UpdateRasterRegion();
 
 	uint32_t width{ 0 }, height{ 0 }, multipleBuffer{ 1 };
 
 	float* zBuffer;
+	uint8_t* stencilBuffer;
 	Vector4f* framebuffer;
-	Vertex* vertexBuffer{ nullptr };
+	InputLayout inputLayout;
 	uint32_t* indexBuffer{ nullptr };
+	InstanceData* instanceBuffer{ nullptr };
 
 	TopologyType topologyType{ TopologyType::TriangleList };
 	SampleCount sampleCount{ SampleCount::Count1 };
+	PipelineState state;
+
+	//Derived from the viewport and scissor state, the raster region is the scissor clamped to the framebuffer
+	Vector3f viewportScale, viewportBias;
+	int rasterLeft{ 0 }, rasterTop{ 0 }, rasterRight{ 0 }, rasterBottom{ 0 };
+
+	PipelineStatistics statistics;
+	CaptureWriter* capture{ nullptr };
 };
 
 class GouraudShaderPipeline : public Pipeline {
 public:
 	using Pipeline::Pipeline;
 
-	void SetShader(GouraudShader shader) { this->shader = shader; }
+	void SetShader(GouraudShader shader);
+	//Indexed by DrawIndexedIndirectArgs::materialId, overrides the shader's material and texture.
+	//Draws whose materialId is not below materialCount are skipped
+	void SetMaterialBuffer(MaterialBinding* materialBuffer, size_t materialCount) {
+		this->materialBuffer = materialBuffer;
+		this->materialCount = materialBuffer ? materialCount : 0;
+	}
 	void Draw(size_t baseVertexOffset, size_t count);
 	void DrawIndexed(size_t indexOffset, size_t baseVertexOffset, size_t count);
+	//Instance data replaces objectConstant's matrices, its color modulates the material
+	void DrawIndexedInstanced(size_t indexCount, size_t instanceCount, size_t indexOffset, size_t baseVertexOffset, size_t baseInstance);
+	//Executes every record of args as one call, instances without an instance buffer use objectConstant
+	void MultiDrawIndexedIndirect(const DrawIndexedIndirectArgs* args, size_t drawCount);
 	
 private:
-	void DrawData(Vertex** vertices, size_t count);
+	//Every blend and depth state combination gets its own instantiation of the draw loop
+	using DrawFunction = void (GouraudShaderPipeline::*)(const uint32_t* indices, size_t count);
+	template<BlendState blendState, CompareFunc depthFunc, bool depthWrite> void DrawData(const uint32_t* indices, size_t count);
+	template<BlendState blendState, CompareFunc depthFunc> DrawFunction SelectDrawFunction(bool depthWrite)const;
+	template<BlendState blendState> DrawFunction SelectDrawFunction(CompareFunc depthFunc, bool depthWrite)const;
+	DrawFunction SelectDrawFunction()const;
+	void DrawData(const uint32_t* indices, size_t count);
+	void DrawInstances(const uint32_t* indices, size_t indexCount, int64_t baseVertex, const InstanceData* instances, size_t instanceCount);
+	//Rebases indices onto the vertex range they reference, restart indices stay UINT32_MAX
+	void DecodeIndices(const uint32_t* indices, size_t count, uint32_t& firstVertex, uint32_t& vertexCount);
+	//Shades every vertex of the range into the transformed vertex buffer, large ranges are split across the job system
+	void VertexStage(size_t firstVertex, size_t count);
+	bool CullInstance(const Vector3f& boundsMin, const Vector3f& boundsMax, const Matrix4x4f& worldMatrix)const;
+
+	static const size_t vertexJobSize = 4096;
+	static const size_t parallelVertexCount = 4 * vertexJobSize;
+
 	GouraudShader shader;
+	MaterialBinding* materialBuffer{ nullptr };
+	size_t materialCount{ 0 };
+	//Primitive assembly reads the vertex stage results through these indices
+	std::vector<uint32_t> assemblyIndices;
+	std::vector<Vector4f> transformedPositions;
+	std::vector<GouraudShader::FragmentInput> transformedOutputs;
 };
\ No newline at end of file
@@ -1,20 +1,26 @@
 #include "Shader.h"
+#include "Core/Math/Batch.h"
 
+//std::min takes it by reference, which needs a definition when the call is not inlined
+const size_t GouraudShader::vertexBatchSize;
+
+template<MathPrecision precision>
 Vector3f LightingUtil::SchlickFresnel(Vector3f R0, Vector3f normal, Vector3f lightVec)const {
 	float cosIncidentAngle = saturate(Dot(normal, lightVec));
 	float f0 = 1.0f - cosIncidentAngle;
-	Vector3f reflectPercent = R0 + powf(f0, 5) * (Vector3f(1.0f) - R0);
+	Vector3f reflectPercent = R0 + Pow5<precision>(f0) * (Vector3f(1.0f) - R0);
 	return reflectPercent;
 }
 
+template<MathPrecision precision>
 Vector3f LightingUtil::BlinnPhong(Vector3f lightStrength, Vector3f lightVec, Vector3f normal, Vector3f toEye, Material mat)const {
 	//΢ƽ
 	const float shininess = mat.shininess * 256.0f;
-	Vector3f halfVec = (toEye + lightVec).Normalize();
-	float roughnessFactor = (shininess + 8.0f) * powf(max(Dot(halfVec, normal), 0.0f), shininess) / 8.0f;
+	Vector3f halfVec = Normalize<precision>(toEye + lightVec);
+	float roughnessFactor = (shininess + 8.0f) * Pow<precision>(max(Dot(halfVec, normal), 0.0f), shininess) / 8.0f;
 
 	//
-	Vector3f reflectPercent = SchlickFresnel(mat.fresnelR0, normal, lightVec);
+	Vector3f reflectPercent = SchlickFresnel<precision>(mat.fresnelR0, normal, lightVec);
 
 	//㾵淴ֵ
 	Vector3f specularAlbedo = roughnessFactor * reflectPercent;
@@ -23,13 +29,15 @@ Vector3f LightingUtil::BlinnPhong(Vector3f lightStrength, Vector3f lightVec, Vec
 	return (mat.diffuseAlbedo.GetVector3f() + specularAlbedo) * lightStrength;
 }
 
+template<MathPrecision precision>
 Vector3f LightingUtil::ComputeDirectionalLight(Light light, Material mat, Vector3f normal, Vector3f toEye)const {
 	Vector3f lightVec = -light.direction;
 	float lambertFactor = max(Dot(normal, lightVec), 0.0f);
 	Vector3f lightStrength = light.strength * lambertFactor;
-	return BlinnPhong(lightStrength, lightVec, normal, toEye, mat);
+	return BlinnPhong<precision>(lightStrength, lightVec, normal, toEye, mat);
 }
 
+template<MathPrecision precision>
 Vector3f LightingUtil::ComputePointLight(Light light, Material mat, Vector3f pos, Vector3f normal, Vector3f toEye)const {
 	Vector3f lightVec = light.position - pos;
 
@@ -39,9 +47,10 @@ Vector3f LightingUtil::ComputePointLight(Light light, Material mat, Vector3f pos
 	float distance = lightVec.Length();
 	lightStrength = lightStrength / (distance * distance);
 
-	return BlinnPhong(lightStrength, lightVec, normal, toEye, mat);
+	return BlinnPhong<precision>(lightStrength, lightVec, normal, toEye, mat);
 }
 
+template<MathPrecision precision>
 Vector3f LightingUtil::ComputeSpotLight(Light light, Material mat, Vector3f pos, Vector3f normal, Vector3f toEye)const {
 	Vector3f lightVec = light.position - pos;
 
@@ -51,10 +60,40 @@ Vector3f LightingUtil::ComputeSpotLight(Light light, Material mat, Vector3f pos,
 	float distance = lightVec.Length();
 	lightStrength = lightStrength / (distance * distance);
 
-	float spotFactor = powf(max(Dot(-lightVec, light.direction), 0.0f), light.spotPower);
+	float spotFactor = Pow<precision>(max(Dot(-lightVec, light.direction), 0.0f), light.spotPower);
 	lightStrength = spotFactor * lightStrength;
 
-	return BlinnPhong(lightStrength, lightVec, normal, toEye, mat);
+	return BlinnPhong<precision>(lightStrength, lightVec, normal, toEye, mat);
+}
+
+void GouraudShader::SetupConstants() {
+	viewProjMatrix = Multiply(passConstant.viewMatrix, passConstant.projMatrix);
+
+	InstanceData instance;
+	instance.worldMatrix = objectConstant.worldMatrix;
+	instance.normalMatrix = objectConstant.normalMatrix;
+	SetInstance(instance);
+}
+
+void GouraudShader::SetInstance(const InstanceData& instance) {
+	instanceConstant.worldMatrix = instance.worldMatrix;
+	instanceConstant.normalMatrix = instance.normalMatrix;
+	instanceConstant.color = instance.color;
+}
+
+Vertex InputLayout::Fetch(size_t index)const {
+	Vertex vertex;
+	vertex.position.w = 1.0f;
+
+	const VertexStream& position = GetStream(VertexAttribute::Position);
+	const VertexStream& color = GetStream(VertexAttribute::Color);
+	const VertexStream& texCoord = GetStream(VertexAttribute::TexCoord);
+	const VertexStream& normal = GetStream(VertexAttribute::Normal);
+	if (position.data) vertex.position = position.Get<Vector4f>(index);
+	if (color.data) vertex.color = color.Get<Vector4f>(index);
+	if (texCoord.data) vertex.texCoord = texCoord.Get<Vector2f>(index);
+	if (normal.data) vertex.normal = normal.Get<Vector3f>(index);
+	return vertex;
 }
 
 GouraudShader::VertexInput GouraudShader::InputAssembler(Vertex* vertex)const {
@@ -66,18 +105,68 @@ GouraudShader::VertexInput GouraudShader::InputAssembler(Vertex* vertex)const {
 }
 
 Vector4f GouraudShader::VertexShader(VertexInput input, FragmentInput& output)const {
-	Matrix4x4f viewProjMatrix = Multiply(passConstant.viewMatrix, passConstant.projMatrix);
-	output.worldPos = Multiply(input.position, objectConstant.worldMatrix).GetVector3f();
-	output.normal = Multiply(Vector4f(input.normal, 0.0f), objectConstant.normalMatrix).GetVector3f();
+	output.worldPos = Multiply(input.position, instanceConstant.worldMatrix).GetVector3f();
+	output.normal = Multiply(Vector4f(input.normal, 0.0f), instanceConstant.normalMatrix).GetVector3f();
 	output.texCoord = input.texCoord;
 	return Multiply(Vector4f(output.worldPos, 1.0f), viewProjMatrix);
 }
 
+void GouraudShader::VertexShader(const InputLayout& layout, size_t firstVertex, size_t count, Vector4f* positions, FragmentInput* outputs)const {
+	const Matrix4x4f& world = instanceConstant.worldMatrix;
+	const Matrix4x4f& normal = instanceConstant.normalMatrix;
+	const Matrix4x4f& viewProj = viewProjMatrix;
+	const VertexStream& positionStream = layout.GetStream(VertexAttribute::Position);
+	const VertexStream& texCoordStream = layout.GetStream(VertexAttribute::TexCoord);
+	const VertexStream& normalStream = layout.GetStream(VertexAttribute::Normal);
+
+	for (size_t first = 0; first < count; first += vertexBatchSize) {
+		size_t lanes = std::min(count - first, vertexBatchSize);
+		size_t vertex = firstVertex + first;
+
+		//One array per component, so the batch kernels run across the lanes
+		float px[vertexBatchSize], py[vertexBatchSize], pz[vertexBatchSize], pw[vertexBatchSize];
+		float nx[vertexBatchSize], ny[vertexBatchSize], nz[vertexBatchSize];
+		for (size_t i = 0; i < lanes; i++) {
+			Vector4f position = positionStream.data ? positionStream.Get<Vector4f>(vertex + i) : Vector4f(0.0f, 0.0f, 0.0f, 1.0f);
+			Vector3f vertexNormal = normalStream.data ? normalStream.Get<Vector3f>(vertex + i) : Vector3f(0.0f);
+			px[i] = position.x, py[i] = position.y, pz[i] = position.z, pw[i] = position.w;
+			nx[i] = vertexNormal.x, ny[i] = vertexNormal.y, nz[i] = vertexNormal.z;
+		}
+
+		float wx[vertexBatchSize], wy[vertexBatchSize], wz[vertexBatchSize];
+		float tx[vertexBatchSize], ty[vertexBatchSize], tz[vertexBatchSize];
+		float cx[vertexBatchSize], cy[vertexBatchSize], cz[vertexBatchSize], cw[vertexBatchSize];
+		TransformPoints(px, py, pz, pw, wx, wy, wz, nullptr, lanes, world);
+		TransformNormals(nx, ny, nz, tx, ty, tz, lanes, normal);
+		TransformPoints(wx, wy, wz, nullptr, cx, cy, cz, cw, lanes, viewProj);
+
+		for (size_t i = 0; i < lanes; i++) {
+			FragmentInput& output = outputs[first + i];
+			output.worldPos = Vector3f(wx[i], wy[i], wz[i]);
+			output.normal = Vector3f(tx[i], ty[i], tz[i]);
+			output.texCoord = texCoordStream.data ? texCoordStream.Get<Vector2f>(vertex + i) : Vector2f();
+			positions[first + i] = Vector4f(cx[i], cy[i], cz[i], cw[i]);
+		}
+	}
+}
+
 Vector4f GouraudShader::FragmentShader(FragmentInput input)const {
-	Vector4f diffuse = materialConstant.diffuseAlbedo * texture->Sample(sampler, input.texCoord);
+	switch (precision) {
+	case MathPrecision::Fast:
+		return ShadeFragment<MathPrecision::Fast>(input);
+	case MathPrecision::Approximate:
+		return ShadeFragment<MathPrecision::Approximate>(input);
+	default:
+		return ShadeFragment<MathPrecision::Precise>(input);
+	}
+}
+
+template<MathPrecision precision>
+Vector4f GouraudShader::ShadeFragment(FragmentInput input)const {
+	Vector4f diffuse = instanceConstant.color * materialConstant.diffuseAlbedo * texture->Sample(sampler, input.texCoord, input.texCoordDdx, input.texCoordDdy);
 
-	input.normal = input.normal.Normalize();
-	Vector3f toEye = (passConstant.eyePos - input.worldPos).Normalize();
+	input.normal = Normalize<precision>(input.normal);
+	Vector3f toEye = Normalize<precision>(passConstant.eyePos - input.worldPos);
 
 	float shininess = 1.0f - materialConstant.roughness;
 	Material mat = { materialConstant.diffuseAlbedo, materialConstant.fresnelR0, shininess };
@@ -85,17 +174,17 @@ Vector4f GouraudShader::FragmentShader(FragmentInput input)const {
 	Vector3f lightingResult(0.0f);
 	switch (passConstant.light.type) {
 	case LightType::Directional:
-		lightingResult = ComputeDirectionalLight(passConstant.light, mat, input.normal, toEye);
+		lightingResult = ComputeDirectionalLight<precision>(passConstant.light, mat, input.normal, toEye);
 		break;
 	case LightType::Point:
-		lightingResult = ComputePointLight(passConstant.light, mat, input.worldPos, input.normal, toEye);
+		lightingResult = ComputePointLight<precision>(passConstant.light, mat, input.worldPos, input.normal, toEye);
 		break;
 	case LightType::Spot:
-		lightingResult = ComputeSpotLight(passConstant.light, mat, input.worldPos, input.normal, toEye);
+		lightingResult = ComputeSpotLight<precision>(passConstant.light, mat, input.worldPos, input.normal, toEye);
 		break;
 	}
 
 	Vector4f litColor = Vector4f((passConstant.ambientLight + lightingResult), 1.0f) * diffuse;
-	litColor.w = materialConstant.diffuseAlbedo.w;
+	litColor.w = instanceConstant.color.w * materialConstant.diffuseAlbedo.w;
 	return saturate(litColor);
 }
\ No newline at end of file
@@ -1,7 +1,36 @@
 #pragma once
 #include "Core/Math/Math.h"
+#include "Core/Math/FastMath.h"
 #include "Function/Texture/Texture.h"
 
+//Attribute types are fixed: Vector4f position and color, Vector2f texCoord, Vector3f normal
+enum class VertexAttribute {
+	Position = 0,
+	Color,
+	TexCoord,
+	Normal,
+	Count
+};
+
+struct VertexStream {
+	const void* data{ nullptr };
+	size_t stride{ 0 };
+
+	template<typename T> const T& Get(size_t index)const {
+		return *reinterpret_cast<const T*>(static_cast<const uint8_t*>(data) + index * stride);
+	}
+};
+
+//One stream per attribute, so tightly packed SoA arrays and interleaved Vertex records can be mixed freely.
+//Unbound attributes read as zero, except position w which reads as one
+struct InputLayout {
+	VertexStream streams[(size_t)VertexAttribute::Count];
+
+	const VertexStream& GetStream(VertexAttribute attribute)const { return streams[(size_t)attribute]; }
+	//Gathers one interleaved record, used where a whole vertex is needed such as frame capture
+	Vertex Fetch(size_t index)const;
+};
+
 struct Material {
 	Vector4f diffuseAlbedo;
 	Vector3f fresnelR0;
@@ -31,11 +60,12 @@ protected:
 		float shininess;
 	};
 
-	Vector3f SchlickFresnel(Vector3f R0, Vector3f normal, Vector3f lightVec)const;
-	Vector3f BlinnPhong(Vector3f lightStrength, Vector3f lightVec, Vector3f normal, Vector3f toEye, Material mat)const;
-	Vector3f ComputeDirectionalLight(Light light, Material mat, Vector3f normal, Vector3f toEye)const;
-	Vector3f ComputePointLight(Light light, Material mat, Vector3f pos, Vector3f normal, Vector3f toEye)const;
-	Vector3f ComputeSpotLight(Light light, Material mat, Vector3f pos, Vector3f normal, Vector3f toEye)const;
+	//Instantiated per MathPrecision, so the chosen tier costs no branch inside the lighting math
+	template<MathPrecision precision> Vector3f SchlickFresnel(Vector3f R0, Vector3f normal, Vector3f lightVec)const;
+	template<MathPrecision precision> Vector3f BlinnPhong(Vector3f lightStrength, Vector3f lightVec, Vector3f normal, Vector3f toEye, Material mat)const;
+	template<MathPrecision precision> Vector3f ComputeDirectionalLight(Light light, Material mat, Vector3f normal, Vector3f toEye)const;
+	template<MathPrecision precision> Vector3f ComputePointLight(Light light, Material mat, Vector3f pos, Vector3f normal, Vector3f toEye)const;
+	template<MathPrecision precision> Vector3f ComputeSpotLight(Light light, Material mat, Vector3f pos, Vector3f normal, Vector3f toEye)const;
 };
 
 class GouraudShader : LightingUtil {
@@ -53,6 +83,13 @@ public:
 		Matrix4x4f normalMatrix;
 	}objectConstant;
 
+	//Filled by the pipeline: from objectConstant for plain draws, from the instance buffer for instanced draws
+	struct {
+		Matrix4x4f worldMatrix;
+		Matrix4x4f normalMatrix;
+		Vector4f color;
+	}instanceConstant;
+
 	struct {
 		Vector4f diffuseAlbedo;
 		Vector3f fresnelR0;
@@ -69,12 +106,30 @@ public:
 		Vector3f worldPos;
 		Vector2f texCoord;
 		Vector3f normal;
+		//Screen space derivatives of texCoord, filled per fragment by the triangle rasterizer and zero elsewhere
+		Vector2f texCoordDdx;
+		Vector2f texCoordDdy;
 	};
 
 	Sampler sampler;
 	Texture* texture{ nullptr };
+	//Accuracy of normalize and pow in the fragment shader, FastMath.h lists the error bounds
+	MathPrecision precision{ MathPrecision::Precise };
 	
+	void SetupConstants();
+	void SetInstance(const InstanceData& instance);
+
 	VertexInput InputAssembler(Vertex* vertex)const;
 	Vector4f VertexShader(VertexInput input, FragmentInput& output)const;
+	//Shades count vertices from firstVertex on in SoA batches of vertexBatchSize with the same operation order as VertexShader,
+	//only the Position, TexCoord and Normal streams are read, unbound ones read as zero (w of 1 for Position)
+	void VertexShader(const InputLayout& layout, size_t firstVertex, size_t count, Vector4f* positions, FragmentInput* outputs)const;
 	Vector4f FragmentShader(FragmentInput input)const;
+
+	static const size_t vertexBatchSize = 64;
+
+private:
+	template<MathPrecision precision> Vector4f ShadeFragment(FragmentInput input)const;
+
+	Matrix4x4f viewProjMatrix;
 };
\ No newline at end of file
@@ -32,6 +32,10 @@ Mesh Model::ProcessMesh(const aiScene* scene, aiMesh* mesh) {
 	std::vector<Vertex> vertices;
 	std::vector<int> indices;
 
+	//Imported normals are not guaranteed to be unit length, aiVector3D has the layout of Vector3f
+	std::vector<Vector3f> normals(mesh->mNumVertices);
+	NormalizeArray(reinterpret_cast<const Vector3f*>(mesh->mNormals), normals.data(), normals.size());
+
 	for (size_t i = 0; i < mesh->mNumVertices; i++) {
 		Vertex vertex;
 		vertex.position.x = mesh->mVertices[i].x;
@@ -41,9 +45,7 @@ Mesh Model::ProcessMesh(const aiScene* scene, aiMesh* mesh) {
 
 		vertex.color = Vector4f(1.0f, 1.0f, 1.0f, 1.0f);
 
-		vertex.normal.x = mesh->mNormals[i].x;
-		vertex.normal.y = mesh->mNormals[i].y;
-		vertex.normal.z = mesh->mNormals[i].z;
+		vertex.normal = normals[i];
 
 		/*vertex.tangent.x = mesh->mTangents[i].x;
 		vertex.tangent.y = mesh->mTangents[i].y;
@@ -4,7 +4,7 @@
 #include "assimp/postprocess.h"
 #include "assimp/mesh.h"
 #include "assimp/texture.h"
-#include "Core/Math/Math.h"
+#include "Core/Math/Batch.h"
 
 struct MaterialInfo {
 	int diffuseMaps;
@@ -163,6 +163,91 @@ private:
 	Vector2i tess;
 };
 
+//Largest triangle patch degree covered by the compile time tables, higher degrees compute their coefficients on the fly
+constexpr size_t maxPatchDegree = 32;
+
+//binomial[n][k] built by Pascal's rule, exact in 64 bits up to maxPatchDegree
+struct BinomialTable {
+	constexpr BinomialTable() : value{} {
+		for (size_t n = 0; n <= maxPatchDegree; n++) {
+			value[n][0] = 1;
+			for (size_t k = 1; k <= n; k++)
+				value[n][k] = value[n - 1][k - 1] + (k < n ? value[n - 1][k] : 0);
+		}
+	}
+
+	uint64_t value[maxPatchDegree + 1][maxPatchDegree + 1];
+};
+
+constexpr BinomialTable binomialTable;
+
+//n! / (i! j! (n - i - j)!) as C(n, i) * C(n - i, j)
+constexpr uint64_t Multinomial(size_t n, size_t i, size_t j) {
+	return binomialTable.value[n][i] * binomialTable.value[n - i][j];
+}
+
+static_assert(Multinomial(3, 1, 1) == 6 && Multinomial(32, 11, 11) == 45508998487680ull, "multinomial table");
+
+//Multinomial of any degree as a Bernstein coefficient. Above the table the product of ratios in double stays within
+//rounding of the exact value long after the integers would overflow
+inline float MultinomialWeight(size_t n, size_t i, size_t j) {
+	if (n <= maxPatchDegree)
+		return (float)Multinomial(n, i, j);
+	double value = 1.0;
+	for (size_t m = 1; m <= i; m++)
+		value = value * (double)(n - i + m) / (double)m;
+	for (size_t m = 1; m <= j; m++)
+		value = value * (double)(n - i - j + m) / (double)m;
+	return (float)value;
+}
+
+//Bernstein weights of every control point of a degree n triangle patch at a fixed set of barycentric samples (u, v, w).
+//Evaluating any patch of that degree on the same pattern is then the product of this matrix with its control points.
+//Control points are ordered by i then j, matching controlPoints[i][j] of TriangulateSurface
+class BernsteinBasis {
+public:
+	BernsteinBasis() {}
+	BernsteinBasis(size_t degree, const std::vector<Vector3f>& samples) : degree(degree), sampleCount(samples.size()) {
+		controlPointCount = (degree + 1) * (degree + 2) / 2;
+		weights.resize(sampleCount * controlPointCount);
+		std::vector<float> up(degree + 1), vp(degree + 1), wp(degree + 1);
+		for (size_t s = 0; s < sampleCount; s++) {
+			up[0] = vp[0] = wp[0] = 1.0f;
+			for (size_t e = 1; e <= degree; e++) {
+				up[e] = up[e - 1] * samples[s].x;
+				vp[e] = vp[e - 1] * samples[s].y;
+				wp[e] = wp[e - 1] * samples[s].z;
+			}
+			float* row = &weights[s * controlPointCount];
+			for (size_t i = 0; i <= degree; i++) {
+				for (size_t j = 0; j <= degree - i; j++)
+					*row++ = MultinomialWeight(degree, i, j) * up[i] * vp[j] * wp[degree - i - j];
+			}
+		}
+	}
+
+	//Every (i, j, k) / tess with i + j + k = tess, ordered like the control points of a degree tess patch
+	static std::vector<Vector3f> UniformSamples(size_t tess) {
+		std::vector<Vector3f> samples;
+		for (size_t i = 0; i <= tess; i++) {
+			for (size_t j = 0; j <= tess - i; j++)
+				samples.push_back(Vector3f((float)i / tess, (float)j / tess, (float)(tess - i - j) / tess));
+		}
+		return samples;
+	}
+
+	size_t GetDegree()const { return degree; }
+	size_t GetSampleCount()const { return sampleCount; }
+	size_t GetControlPointCount()const { return controlPointCount; }
+	const float* GetWeights(size_t sample)const { return &weights[sample * controlPointCount]; }
+
+private:
+	size_t degree{ 0 };
+	size_t sampleCount{ 0 };
+	size_t controlPointCount{ 0 };
+	std::vector<float> weights;
+};
+
 class TriangulateSurface {
 public:
 	TriangulateSurface() {}
@@ -218,14 +303,30 @@ public:
 		};
 	}
 
+	//Single point, for many points on a fixed pattern Evaluate with a shared BernsteinBasis is cheaper
 	Vertex GetSurfacePoint(float u, float v, float w) {
-		int n = controlPoints.size() - 1;
+		size_t n = GetDegree();
+		//Powers live on the stack up to maxPatchDegree
+		float stackPowers[3 * (maxPatchDegree + 1)];
+		std::vector<float> heapPowers;
+		float* up = stackPowers;
+		if (n > maxPatchDegree) {
+			heapPowers.resize(3 * (n + 1));
+			up = heapPowers.data();
+		}
+		float* vp = up + n + 1;
+		float* wp = vp + n + 1;
+		up[0] = vp[0] = wp[0] = 1.0f;
+		for (size_t e = 1; e <= n; e++) {
+			up[e] = up[e - 1] * u;
+			vp[e] = vp[e - 1] * v;
+			wp[e] = wp[e - 1] * w;
+		}
+
 		Vertex point;
-		for (int i = n; i >= 0; i--) {
-			for (int j = n - i; j >= 0; j--) {
-				int k = n - i - j;
-				float bernstein = Factorial(n) / (Factorial(i) * Factorial(j) * Factorial(k))
-					* powf(u, i) * powf(v, j) * powf(w, k);
+		for (size_t i = 0; i <= n; i++) {
+			for (size_t j = 0; j <= n - i; j++) {
+				float bernstein = MultinomialWeight(n, i, j) * up[i] * vp[j] * wp[n - i - j];
 				point.position = point.position + bernstein * controlPoints[i][j].position;
 				point.color = point.color + bernstein * controlPoints[i][j].color;
 			}
@@ -233,6 +334,27 @@ public:
 		return point;
 	}
 
+	size_t GetDegree()const {
+		return controlPoints.size() - 1;
+	}
+
+	//One vertex per sample of basis, whose degree must match the patch
+	void Evaluate(const BernsteinBasis& basis, std::vector<Vertex>& points)const {
+		size_t n = GetDegree();
+		points.resize(basis.GetSampleCount());
+		for (size_t s = 0; s < basis.GetSampleCount(); s++) {
+			const float* bernstein = basis.GetWeights(s);
+			Vertex point;
+			for (size_t i = 0; i <= n; i++) {
+				for (size_t j = 0; j <= n - i; j++, bernstein++) {
+					point.position = point.position + *bernstein * controlPoints[i][j].position;
+					point.color = point.color + *bernstein * controlPoints[i][j].color;
+				}
+			}
+			points[s] = point;
+		}
+	}
+
 	Vertex GetSurfacePointRecursive(float u, float v, float w) {
 		return GetSurfacePointRecursive(controlPoints, u, v, w);
 	}
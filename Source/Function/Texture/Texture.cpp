@@ -1,121 +1,755 @@
+//The failure reason is a global that concurrent loads would race on, and nothing reads it
+#define STBI_NO_FAILURE_STRINGS
 #define STB_IMAGE_IMPLEMENTATION
 #include "Texture.h"
+#include "TextureCache.h"
+#include "Core/Job/JobSystem.h"
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#include "stb/stb_image_resize.h"
+#define STB_DXT_IMPLEMENTATION
+#include "stb/stb_dxt.h"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+
+#if defined(MATH_SSE) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define TEXTURE_SSE2
+#include <emmintrin.h>
+#endif
+
+//Texels are filtered and converted as RGBA8, every format expands to it
+const uint32_t texelSize = 4;
+
+static bool IsCompressed(TextureFormat format) {
+	return format == TextureFormat::BC1 || format == TextureFormat::BC3;
+}
+
+//Bytes per 4x4 block of the compressed formats
+static size_t BlockSize(TextureFormat format) {
+	return format == TextureFormat::BC1 ? 8 : 16;
+}
+
+//Bytes per texel of the uncompressed formats
+static uint32_t TexelSize(TextureFormat format) {
+	switch (format) {
+	case TextureFormat::R8:
+		return 1;
+	case TextureFormat::RG8:
+	case TextureFormat::RGB565:
+		return 2;
+	default:
+		return texelSize;
+	}
+}
+
+uint32_t Texture::GetFormatBPP(TextureFormat format) {
+	return IsCompressed(format) ? (uint32_t)BlockSize(format) / 2 : TexelSize(format) * 8;
+}
+
+//Bilinear weights have 8 fractional bits, so a row blend fits 16 bits and the final blend 24 bits, which float holds exactly
+const int filterBits = 8;
+const int filterOne = 1 << filterBits;
+const float filterScale = 1.0f / (255.0f * (float)(filterOne * filterOne));
+
+static uint32_t NextPowerOfTwo(uint32_t value) {
+	value--;
+	value |= value >> 1;
+	value |= value >> 2;
+	value |= value >> 4;
+	value |= value >> 8;
+	value |= value >> 16;
+	return value + 1;
+}
+
+//Moves the low 16 bits of value to the even bit positions
+static uint32_t SpreadBits(uint32_t value) {
+	value &= 0x0000ffff;
+	value = (value | (value << 8)) & 0x00ff00ff;
+	value = (value | (value << 4)) & 0x0f0f0f0f;
+	value = (value | (value << 2)) & 0x33333333;
+	value = (value | (value << 1)) & 0x55555555;
+	return value;
+}
+
+template<TextureLayout layout> static size_t TexelIndex(uint32_t width, uint32_t height, uint32_t x, uint32_t y) {
+	if (layout == TextureLayout::Tiled4x4) {
+		uint32_t tileCountX = (width + 3) >> 2;
+		return ((size_t)(y >> 2) * tileCountX + (x >> 2)) * 16 + ((y & 3) << 2) + (x & 3);
+	}
+	if (layout == TextureLayout::Morton) {
+		//Bits above the shorter padded side belong to one coordinate only, they select a square block of that side
+		uint32_t side = std::min(NextPowerOfTwo(width), NextPowerOfTwo(height));
+		uint32_t mask = side - 1;
+		return (SpreadBits(x & mask) | SpreadBits(y & mask) << 1) + (size_t)((x | y) & ~mask) * side;
+	}
+	return (size_t)y * width + x;
+}
+
+static size_t TexelIndex(TextureLayout layout, uint32_t width, uint32_t height, uint32_t x, uint32_t y) {
+	switch (layout) {
+	case TextureLayout::Tiled4x4:
+		return TexelIndex<TextureLayout::Tiled4x4>(width, height, x, y);
+	case TextureLayout::Morton:
+		return TexelIndex<TextureLayout::Morton>(width, height, x, y);
+	default:
+		return TexelIndex<TextureLayout::Linear>(width, height, x, y);
+	}
+}
+
+//One texel of an uncompressed format as RGBA8 with the channels in memory order. 5:6:5 widens by repeating the high
+//bits like the BC endpoints
+template<TextureFormat format> static uint32_t ExpandTexel(const stbi_uc* source) {
+	stbi_uc channels[4];
+	if (format == TextureFormat::R8) {
+		channels[0] = channels[1] = channels[2] = source[0];
+		channels[3] = 255;
+	}
+	else if (format == TextureFormat::RG8) {
+		channels[0] = channels[1] = channels[2] = source[0];
+		channels[3] = source[1];
+	}
+	else if (format == TextureFormat::RGB565) {
+		uint32_t value = source[0] | source[1] << 8;
+		uint32_t r = value >> 11 & 31, g = value >> 5 & 63, b = value & 31;
+		channels[0] = (stbi_uc)(r << 3 | r >> 2);
+		channels[1] = (stbi_uc)(g << 2 | g >> 4);
+		channels[2] = (stbi_uc)(b << 3 | b >> 2);
+		channels[3] = 255;
+	}
+	else {
+		memcpy(channels, source, texelSize);
+	}
+	uint32_t texel;
+	memcpy(&texel, channels, texelSize);
+	return texel;
+}
+
+static void ExpandTexel(TextureFormat format, const stbi_uc* source, stbi_uc* texel) {
+	uint32_t expanded;
+	switch (format) {
+	case TextureFormat::R8:
+		expanded = ExpandTexel<TextureFormat::R8>(source);
+		break;
+	case TextureFormat::RG8:
+		expanded = ExpandTexel<TextureFormat::RG8>(source);
+		break;
+	case TextureFormat::RGB565:
+		expanded = ExpandTexel<TextureFormat::RGB565>(source);
+		break;
+	default:
+		expanded = ExpandTexel<TextureFormat::RGBA8>(source);
+		break;
+	}
+	memcpy(texel, &expanded, texelSize);
+}
+
+//The inverse of ExpandTexel, R8 keeps red, RG8 red and alpha and RGB565 rounds each channel to nearest
+static void PackTexel(TextureFormat format, const stbi_uc* texel, stbi_uc* destination) {
+	switch (format) {
+	case TextureFormat::R8:
+		destination[0] = texel[0];
+		break;
+	case TextureFormat::RG8:
+		destination[0] = texel[0];
+		destination[1] = texel[3];
+		break;
+	case TextureFormat::RGB565: {
+		uint32_t value = (texel[0] * 31 + 127) / 255 << 11 | (texel[1] * 63 + 127) / 255 << 5 | (texel[2] * 31 + 127) / 255;
+		destination[0] = (stbi_uc)value;
+		destination[1] = (stbi_uc)(value >> 8);
+		break;
+	}
+	default:
+		memcpy(destination, texel, texelSize);
+		break;
+	}
+}
+
+//The palette of a color block from its two 5:6:5 endpoints. BC3 always uses four colors, BC1 switches to three colors
+//and transparent black when the first endpoint is not the larger one
+static void DecodeColorBlock(const stbi_uc* block, bool alwaysFourColors, stbi_uc* texels) {
+	uint32_t endpoints[2] = { (uint32_t)(block[0] | block[1] << 8), (uint32_t)(block[2] | block[3] << 8) };
+	stbi_uc palette[4][4];
+	for (int i = 0; i < 2; i++) {
+		uint32_t r = endpoints[i] >> 11 & 31, g = endpoints[i] >> 5 & 63, b = endpoints[i] & 31;
+		palette[i][0] = (stbi_uc)(r << 3 | r >> 2);
+		palette[i][1] = (stbi_uc)(g << 2 | g >> 4);
+		palette[i][2] = (stbi_uc)(b << 3 | b >> 2);
+		palette[i][3] = 255;
+	}
+	bool fourColors = alwaysFourColors || endpoints[0] > endpoints[1];
+	for (int i = 0; i < 3; i++) {
+		palette[2][i] = (stbi_uc)(fourColors ? (2 * palette[0][i] + palette[1][i]) / 3 : (palette[0][i] + palette[1][i]) / 2);
+		palette[3][i] = (stbi_uc)(fourColors ? (palette[0][i] + 2 * palette[1][i]) / 3 : 0);
+	}
+	palette[2][3] = 255;
+	palette[3][3] = fourColors ? 255 : 0;
+
+	uint32_t indices = block[4] | block[5] << 8 | block[6] << 16 | (uint32_t)block[7] << 24;
+	for (int i = 0; i < 16; i++)
+		memcpy(texels + i * texelSize, palette[indices >> 2 * i & 3], texelSize);
+}
+
+//Eight alphas from two endpoints, or six plus zero and one when the first endpoint is not the larger one
+static void DecodeAlphaBlock(const stbi_uc* block, stbi_uc* texels) {
+	uint32_t alpha0 = block[0], alpha1 = block[1];
+	stbi_uc palette[8] = { (stbi_uc)alpha0, (stbi_uc)alpha1 };
+	if (alpha0 > alpha1) {
+		for (uint32_t i = 1; i < 7; i++)
+			palette[i + 1] = (stbi_uc)(((7 - i) * alpha0 + i * alpha1) / 7);
+	}
+	else {
+		for (uint32_t i = 1; i < 5; i++)
+			palette[i + 1] = (stbi_uc)(((5 - i) * alpha0 + i * alpha1) / 5);
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+
+	uint64_t indices = 0;
+	for (int i = 0; i < 6; i++)
+		indices |= (uint64_t)block[2 + i] << 8 * i;
+	for (int i = 0; i < 16; i++)
+		texels[i * texelSize + 3] = palette[indices >> 3 * i & 7];
+}
+
+//Writes the 16 texels of a block as RGBA8 in row order
+static void DecodeBlock(TextureFormat format, const stbi_uc* block, stbi_uc* texels) {
+	if (format == TextureFormat::BC3) {
+		DecodeColorBlock(block + 8, true, texels);
+		DecodeAlphaBlock(block, texels);
+	}
+	else {
+		DecodeColorBlock(block, false, texels);
+	}
+}
+
+//Decoded blocks of compressed images, kept per thread so sampling takes no lock. Direct mapped on the block coordinates:
+//even and odd block rows take separate halves, so a span of up to 128 blocks across two rows (what a bilinear footprint
+//walks along a scanline) stays resident. Freeing compressed data starts a new generation, which invalidates every entry
+//in every thread at once
+struct DecodedBlock {
+	const stbi_uc* block{ nullptr };
+	uint32_t generation{ 0 };
+	stbi_uc texels[16 * texelSize];
+};
+
+const size_t blockCacheSize = 256;
+static std::atomic<uint32_t> blockCacheGeneration{ 1 };
+static thread_local DecodedBlock blockCache[blockCacheSize];
+
+static void FreeImageSource(Image& image) {
+	if (IsCompressed(image.format))
+		blockCacheGeneration.fetch_add(1, std::memory_order_relaxed);
+	if (image.ownsSource)
+		stbi_image_free(image.source);
+	image.source = nullptr;
+	image.ownsSource = true;
+}
+
+//Reads count RGBA8 texels with the channels in memory order. Neighbouring texels of a compressed image usually share
+//a block, so consecutive texels in one block decode or look it up only once
+template<TextureFormat format, TextureLayout layout, size_t count>
+static void FetchTexels(const Image& image, const uint32_t (&x)[count], const uint32_t (&y)[count], uint32_t (&texels)[count]) {
+	if (!IsCompressed(format)) {
+		for (size_t i = 0; i < count; i++)
+			texels[i] = ExpandTexel<format>(image.source + TexelIndex<layout>(image.width, image.height, x[i], y[i]) * TexelSize(format));
+		return;
+	}
+
+	const size_t blockSize = format == TextureFormat::BC1 ? 8 : 16;
+	uint32_t blockCountX = (image.width + 3) >> 2;
+	uint32_t generation = blockCacheGeneration.load(std::memory_order_relaxed);
+	//Only the entry of the latest block is read, so later lookups evicting it do no harm
+	const stbi_uc* lastBlock = nullptr;
+	const stbi_uc* decoded = nullptr;
+	for (size_t i = 0; i < count; i++) {
+		uint32_t blockX = x[i] >> 2, blockY = y[i] >> 2;
+		const stbi_uc* block = image.source + ((size_t)blockY * blockCountX + blockX) * blockSize;
+		if (block != lastBlock) {
+			auto& entry = blockCache[(blockX & (blockCacheSize / 2 - 1)) | (blockY & 1) * (blockCacheSize / 2)];
+			if (entry.block != block || entry.generation != generation) {
+				DecodeBlock(format, block, entry.texels);
+				entry.block = block;
+				entry.generation = generation;
+			}
+			lastBlock = block;
+			decoded = entry.texels;
+		}
+		memcpy(&texels[i], decoded + ((y[i] & 3) * 4 + (x[i] & 3)) * texelSize, texelSize);
+	}
+}
+
+static Vector4f UnpackTexel(uint32_t texel) {
+	stbi_uc channels[4];
+	memcpy(channels, &texel, texelSize);
+	const float scale = 1.0f / 255.0f;
+	return Vector4f((float)channels[0] * scale, (float)channels[1] * scale, (float)channels[2] * scale, (float)channels[3] * scale);
+}
+
+//Blends four RGBA8 texels (left/right, top/bottom) with weights in [0, filterOne] and converts to float once at the end.
+//Every path runs the same integer arithmetic, so SSE2, NEON and scalar builds give identical results
+static Vector4f FilterBilinear(uint32_t t00, uint32_t t10, uint32_t t01, uint32_t t11, int weightX, int weightY) {
+#if defined(TEXTURE_SSE2)
+	auto load = [](uint32_t texel) { return _mm_cvtsi32_si128((int)texel); };
+	//Interleaving the left and right texel puts each channel pair in one 32 bit lane for pmaddwd
+	__m128i zero = _mm_setzero_si128();
+	__m128i weightsX = _mm_set1_epi32(weightX << 16 | (filterOne - weightX));
+	__m128i top = _mm_madd_epi16(_mm_unpacklo_epi8(_mm_unpacklo_epi8(load(t00), load(t10)), zero), weightsX);
+	__m128i bottom = _mm_madd_epi16(_mm_unpacklo_epi8(_mm_unpacklo_epi8(load(t01), load(t11)), zero), weightsX);
+
+	//Rows reach 255 * filterOne, biased down by 32768 they pack to signed 16 bits. The weights sum to filterOne,
+	//so the bias comes back out of the second pmaddwd as 32768 * filterOne
+	__m128i bias = _mm_set1_epi32(32768);
+	__m128i rows = _mm_packs_epi32(_mm_sub_epi32(top, bias), _mm_sub_epi32(bottom, bias));
+	rows = _mm_unpacklo_epi16(rows, _mm_unpackhi_epi64(rows, rows));
+	__m128i weightsY = _mm_set1_epi32(weightY << 16 | (filterOne - weightY));
+	__m128i color = _mm_add_epi32(_mm_madd_epi16(rows, weightsY), _mm_set1_epi32(32768 * filterOne));
+	return StoreVector4f(_mm_mul_ps(_mm_cvtepi32_ps(color), _mm_set1_ps(filterScale)));
+#elif defined(MATH_NEON)
+	auto load = [](uint32_t texel) { return vget_low_u16(vmovl_u8(vcreate_u8(texel))); };
+	uint32x4_t top = vmlal_n_u16(vmull_n_u16(load(t00), (uint16_t)(filterOne - weightX)), load(t10), (uint16_t)weightX);
+	uint32x4_t bottom = vmlal_n_u16(vmull_n_u16(load(t01), (uint16_t)(filterOne - weightX)), load(t11), (uint16_t)weightX);
+	uint32x4_t color = vmlaq_n_u32(vmulq_n_u32(top, (uint32_t)(filterOne - weightY)), bottom, (uint32_t)weightY);
+	return StoreVector4f(vmulq_n_f32(vcvtq_f32_u32(color), filterScale));
+#else
+	stbi_uc texels[4][4];
+	memcpy(texels[0], &t00, texelSize);
+	memcpy(texels[1], &t10, texelSize);
+	memcpy(texels[2], &t01, texelSize);
+	memcpy(texels[3], &t11, texelSize);
+	float color[4];
+	for (int i = 0; i < 4; i++) {
+		int top = texels[0][i] * (filterOne - weightX) + texels[1][i] * weightX;
+		int bottom = texels[2][i] * (filterOne - weightX) + texels[3][i] * weightX;
+		color[i] = (float)(top * (filterOne - weightY) + bottom * weightY) * filterScale;
+	}
+	return Vector4f(color[0], color[1], color[2], color[3]);
+#endif
+}
+
+uint64_t Texture::CalcImageSize(uint32_t width, uint32_t height, TextureLayout layout, TextureFormat format) {
+	if (IsCompressed(format))
+		return (uint64_t)((width + 3) >> 2) * (uint64_t)((height + 3) >> 2) * BlockSize(format);
+
+	switch (layout) {
+	case TextureLayout::Tiled4x4:
+		return (uint64_t)((width + 3) & ~3u) * (uint64_t)((height + 3) & ~3u) * TexelSize(format);
+	case TextureLayout::Morton:
+		return (uint64_t)NextPowerOfTwo(width) * (uint64_t)NextPowerOfTwo(height) * TexelSize(format);
+	default:
+		return (uint64_t)width * (uint64_t)height * TexelSize(format);
+	}
+}
+
+//Channels to decode for BPP, or for the file when BPP is 0. There is no three channel format, RGB files decode as RGBA
+static int ChannelCount(uint32_t BPP, int channelInFile) {
+	int channels = BPP == 0 ? channelInFile : BPP <= 8 ? 1 : BPP <= 16 ? 2 : 4;
+	return channels == 3 ? 4 : channels;
+}
+
+//Takes over a row-major image decoded by stb_image with the given channel count
+static void AssignDecodedImage(Image& image, stbi_uc* source, int channels) {
+	image.format = channels == 1 ? TextureFormat::R8 : channels == 2 ? TextureFormat::RG8 : TextureFormat::RGBA8;
+	image.layout = TextureLayout::Linear;
+	image.BPP = Texture::GetFormatBPP(image.format);
+	image.imageSize = Texture::CalcImageSize(image.width, image.height, image.layout, image.format);
+	image.source = source;
+	image.ownsSource = true;
+}
 
 void Texture::Release() {
 	for (size_t i = 0; i < subresourceCount; i++) {
-		stbi_image_free(images[i].source);
+		FreeImageSource(images[i]);
 	}
 	delete[] images;
+	delete mapping;
+	mapping = nullptr;
 }
 
 void Texture::LoadImageWithSTB(const char* path, uint32_t BPP, size_t subresource) {
 	auto& image = images[subresource];
-	image.BPP = BPP;
-	int channelInFile;
-	stbi_uc* source = stbi_load(path, reinterpret_cast<int*>(&image.width), reinterpret_cast<int*>(&image.height), &channelInFile, 4);
-
-	uint64_t pixelRowPitch = ((uint64_t)image.width * (uint64_t)BPP + 7) / 8;
-	image.imageSize = pixelRowPitch * (uint64_t)image.height;
-
-	image.source = reinterpret_cast<uint8_t*>(source);
+	int width, height, channelInFile = 4;
+	if (BPP == 0)
+		stbi_info(path, &width, &height, &channelInFile);
+	int channels = ChannelCount(BPP, channelInFile);
+	stbi_uc* source = stbi_load(path, reinterpret_cast<int*>(&image.width), reinterpret_cast<int*>(&image.height), &channelInFile, channels);
+	AssignDecodedImage(image, source, channels);
 }
 
 void Texture::LoadImageWithSTB(const char* path, uint32_t BPP) {
 	LoadImageWithSTB(path, BPP, 0);
 }
 
-Vector4f Texture::Sample(Sampler sampler, Vector2f coord)const {
-	float x = sampler.Address(sampler.addressModeU, coord.x);
-	float y = sampler.Address(sampler.addressModeV, coord.y);
-	if (x == -1.0f || y == -1.0f)
-		return sampler.borderColor;
-	auto& image = images[0];
-
-	y = 1.0f - y;
+void Texture::LoadImageWithSTB(const stbi_uc* file, size_t fileSize, uint32_t BPP, size_t subresource) {
+	auto& image = images[subresource];
+	int width, height, channelInFile = 4;
+	if (BPP == 0)
+		stbi_info_from_memory(file, (int)fileSize, &width, &height, &channelInFile);
+	int channels = ChannelCount(BPP, channelInFile);
+	stbi_uc* source = stbi_load_from_memory(file, (int)fileSize, reinterpret_cast<int*>(&image.width), reinterpret_cast<int*>(&image.height),
+		&channelInFile, channels);
+	AssignDecodedImage(image, source, channels);
+}
 
-	x = x * (float)image.width;
-	y = y * (float)image.height;
+void Texture::LoadBatchWithSTB(Texture* const* textures, const char* const* paths, size_t count, uint32_t BPP,
+	bool generateMips, TextureLoadTime* times) {
+	JobSystem::Get().ParallelFor(count, 1, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			auto start = std::chrono::steady_clock::now();
+			textures[i]->LoadImageWithSTB(paths[i], BPP);
+			auto decoded = std::chrono::steady_clock::now();
+			if (generateMips && textures[i]->images[0].source)
+				textures[i]->GenerateMips();
+			auto end = std::chrono::steady_clock::now();
 
-	x -= 0.5f;
-	y -= 0.5f;
+			if (times) {
+				times[i].decodeMilliseconds = std::chrono::duration<double, std::milli>(decoded - start).count();
+				times[i].mipMilliseconds = std::chrono::duration<double, std::milli>(end - decoded).count();
+			}
+		}
+	});
+}
 
-	int width = x;
-	int height = y;
+void Texture::LoadImageFromMemory(uint32_t width, uint32_t height, uint32_t BPP, const stbi_uc* source, size_t subresource,
+	TextureLayout layout, TextureFormat format) {
+	auto& image = images[subresource];
+	image.width = width;
+	image.height = height;
+	image.BPP = BPP;
+	image.layout = layout;
+	image.format = format;
+	image.imageSize = CalcImageSize(width, height, layout, format);
 
-	if (x - width > 0.5f)width++;
-	if (x - height > 0.5f)height++;
+	if (!source)
+		return;
 
-	int byte = image.BPP / 32;
+	//Allocated with malloc so that Release can free it like stb image data
+	image.source = reinterpret_cast<stbi_uc*>(STBI_MALLOC(image.imageSize));
+	image.ownsSource = true;
+	memcpy(image.source, source, image.imageSize);
+}
 
-	switch (sampler.filter) {
-	case Sampler::Filter::Nearest: {
-		Vector4f color;
-		color.x = (float)image.source[height * image.width * byte * 4 + width * 4] / 255.0f;
-		color.y = (float)image.source[height * image.width * byte * 4 + width * 4 + 1] / 255.0f;
-		color.z = (float)image.source[height * image.width * byte * 4 + width * 4 + 2] / 255.0f;
-		color.w = (float)image.source[height * image.width * byte * 4 + width * 4 + 3] / 255.0f;
-		return color;
+void Texture::Evict(size_t level) {
+	level = std::min(level, subresourceCount - 1);
+	for (size_t i = residentLevel; i < level; i++) {
+		//Mapped levels are not freed with the rest of the file, their pages are handed back instead
+		if (mapping && !images[i].ownsSource && images[i].source)
+			mapping->Discard(images[i].source, images[i].imageSize);
+		FreeImageSource(images[i]);
 	}
-	case Sampler::Filter::Linear: {
-		Vector4f color[4];
-		for (int i = 0; i < 4; i++) {
-			if (i == 1 && x > 0.0f && x < 9.0f)
-				width++;
-			if (i == 2 && x > 0.0f && x < 9.0f)
-				width--;
-			if (i == 3 && x > 0.0f && x < 9.0f)
-				width++;
-			if (i == 2 && y > 0.0f && y < 9.0f)
-				height++;
-
-			color[i].x = (float)image.source[height * image.width * byte * 4 + width * 4] / 255.0f;
-			color[i].y = (float)image.source[height * image.width * byte * 4 + width * 4 + 1] / 255.0f;
-			color[i].z = (float)image.source[height * image.width * byte * 4 + width * 4 + 2] / 255.0f;
-			color[i].w = (float)image.source[height * image.width * byte * 4 + width * 4 + 3] / 255.0f;
-		}
+	residentLevel = std::max(residentLevel, level);
+}
+
+void Texture::GenerateMips() {
+	//stb_image_resize works on row-major images of whole byte channels, which it filters independently,
+	//so R8 and RG8 levels match the channels of RGBA8 ones
+	TextureFormat format = GetFormat();
+	TextureLayout layout = GetLayout();
+	if (format != TextureFormat::R8 && format != TextureFormat::RG8)
+		SetFormat(TextureFormat::RGBA8);
+	SetLayout(TextureLayout::Linear);
+
+	const Image& base = images[0];
+	size_t levelCount = 1;
+	while ((base.width >> levelCount) > 0 || (base.height >> levelCount) > 0)
+		levelCount++;
 
-		float lerpX = (x - width) / 1.0f;
-		float lerpY = (y - height) / 1.0f;
+	Image* mips = new Image[levelCount];
+	mips[0] = base;
+	for (size_t level = 1; level < levelCount; level++) {
+		const Image& source = mips[level - 1];
+		auto& image = mips[level];
+		image.width = std::max(base.width >> level, 1u);
+		image.height = std::max(base.height >> level, 1u);
+		image.BPP = base.BPP;
+		image.format = base.format;
+		image.imageSize = CalcImageSize(image.width, image.height, image.layout, image.format);
 
-		color[0] = Lerp(color[0], color[1], lerpX);
-		color[2] = Lerp(color[2], color[3], lerpX);
-		return Lerp(color[0], color[2], lerpY);
+		image.source = reinterpret_cast<stbi_uc*>(STBI_MALLOC(image.imageSize));
+		stbir_resize_uint8(source.source, source.width, source.height, 0, image.source, image.width, image.height, 0, (int)TexelSize(image.format));
 	}
+
+	for (size_t i = 1; i < subresourceCount; i++) {
+		FreeImageSource(images[i]);
 	}
+	delete[] images;
+	images = mips;
+	subresourceCount = levelCount;
+
+	SetLayout(layout);
+	SetFormat(format);
 }
 
-float Sampler::Address(AddressMode addressMode, float coord)const {
-	switch (addressMode) {
-	case AddressMode::Repeat:
-		while (coord > 1.0f) {
-			coord -= 1.0f;
+void Texture::SetLayout(TextureLayout layout) {
+	for (size_t i = 0; i < subresourceCount; i++) {
+		auto& image = images[i];
+		if (image.layout == layout || !image.source || IsCompressed(image.format))
+			continue;
+
+		//Padding texels are zeroed so captures stay deterministic
+		uint64_t imageSize = CalcImageSize(image.width, image.height, layout, image.format);
+		stbi_uc* source = reinterpret_cast<stbi_uc*>(STBI_MALLOC(imageSize));
+		memset(source, 0, imageSize);
+		uint32_t size = TexelSize(image.format);
+		for (uint32_t y = 0; y < image.height; y++) {
+			for (uint32_t x = 0; x < image.width; x++) {
+				memcpy(source + TexelIndex(layout, image.width, image.height, x, y) * size,
+					image.source + TexelIndex(image.layout, image.width, image.height, x, y) * size, size);
+			}
 		}
-		while (coord < 0.0f) {
-			coord += 1.0f;
+
+		FreeImageSource(image);
+		image.source = source;
+		image.imageSize = imageSize;
+		image.layout = layout;
+	}
+}
+
+//stb_dxt builds its tables on first use without a lock, so the first use is serialized here before textures
+//compress on several threads
+static void InitCompressor() {
+	static bool initialized = [] {
+		stbi_uc block[16], texels[16 * texelSize] = {};
+		stb_compress_dxt_block(block, texels, 0, STB_DXT_NORMAL);
+		return true;
+	}();
+	(void)initialized;
+}
+
+void Texture::SetFormat(TextureFormat format) {
+	if (format != TextureFormat::RGBA8) {
+		//Every other pair of formats converts through RGBA8
+		SetFormat(TextureFormat::RGBA8);
+		if (IsCompressed(format)) {
+			InitCompressor();
+			//Blocks are gathered from row-major texels
+			SetLayout(TextureLayout::Linear);
 		}
-		break;
-	case AddressMode::Mirror:
-	{
-		bool mirror = false;
-		while (coord > 1.0f) {
-			coord -= 1.0f;
-			mirror = !mirror;
+	}
+
+	for (size_t i = 0; i < subresourceCount; i++) {
+		auto& image = images[i];
+		if (image.format == format || !image.source)
+			continue;
+
+		//Compressed images are always Linear, so the layout carries over either way
+		uint64_t imageSize = CalcImageSize(image.width, image.height, image.layout, format);
+		stbi_uc* source = reinterpret_cast<stbi_uc*>(STBI_MALLOC(imageSize));
+
+		if (!IsCompressed(image.format) && !IsCompressed(format)) {
+			//Texel for texel in the same order, padding included
+			uint32_t sourceSize = TexelSize(image.format), destinationSize = TexelSize(format);
+			uint64_t texelCount = image.imageSize / sourceSize;
+			for (uint64_t j = 0; j < texelCount; j++) {
+				if (format == TextureFormat::RGBA8)
+					ExpandTexel(image.format, image.source + j * sourceSize, source + j * destinationSize);
+				else
+					PackTexel(format, image.source + j * sourceSize, source + j * destinationSize);
+			}
 		}
-		while (coord < 0.0f) {
-			coord += 1.0f;
-			mirror = !mirror;
+		else {
+			uint32_t blockCountX = (image.width + 3) >> 2, blockCountY = (image.height + 3) >> 2;
+			stbi_uc texels[16 * texelSize];
+			for (uint32_t blockY = 0; blockY < blockCountY; blockY++) {
+				for (uint32_t blockX = 0; blockX < blockCountX; blockX++) {
+					if (format == TextureFormat::RGBA8) {
+						DecodeBlock(image.format, image.source + ((size_t)blockY * blockCountX + blockX) * BlockSize(image.format), texels);
+						for (uint32_t y = blockY * 4; y < std::min(blockY * 4 + 4, image.height); y++) {
+							for (uint32_t x = blockX * 4; x < std::min(blockX * 4 + 4, image.width); x++)
+								memcpy(source + ((size_t)y * image.width + x) * texelSize, texels + ((y & 3) * 4 + (x & 3)) * texelSize, texelSize);
+						}
+					}
+					else {
+						//Blocks past the edge repeat the last row and column
+						for (uint32_t j = 0; j < 16; j++) {
+							uint32_t x = std::min(blockX * 4 + (j & 3), image.width - 1), y = std::min(blockY * 4 + (j >> 2), image.height - 1);
+							memcpy(texels + j * texelSize, image.source + ((size_t)y * image.width + x) * texelSize, texelSize);
+						}
+						stb_compress_dxt_block(source + ((size_t)blockY * blockCountX + blockX) * BlockSize(format), texels,
+							format == TextureFormat::BC3, STB_DXT_NORMAL);
+					}
+				}
+			}
 		}
-		if (mirror)
-			coord = 1.0f - coord;
-		break;
+
+		FreeImageSource(image);
+		image.source = source;
+		image.imageSize = imageSize;
+		image.BPP = GetFormatBPP(format);
+		image.format = format;
 	}
-	case AddressMode::Clamp:
-		coord = coord > 1.0f ? 1.0f : coord;
-		coord = coord < 0.0f ? 0.0f : coord;
-		break;
-	case AddressMode::Border:
-		coord = coord > 1.0f || coord < 0.0f ? -1.0f : coord;
-		break;
+}
+
+Vector4f Texture::Sample(Sampler sampler, Vector2f coord)const {
+	return SampleImage(sampler, coord, 0);
+}
+
+//First sampling variant of each format in TextureFormat order, uncompressed formats take one per layout
+const size_t variantOffsets[] = { 0, 3, 4, 5, 8, 11 };
+
+static size_t VariantIndex(const Image& image) {
+	size_t offset = variantOffsets[(size_t)image.format];
+	return IsCompressed(image.format) ? offset : offset + (size_t)image.layout;
+}
+
+void Texture::Sample(Sampler sampler, const Vector2f* coords, size_t count, Vector4f* colors)const {
+	if (residentLevel > 0)
+		requestedLevel = 0;
+	auto& image = images[residentLevel];
+	Sampler::SampleFunction sample = sampler.variant[VariantIndex(image)];
+	for (size_t i = 0; i < count; i++)
+		colors[i] = sample(sampler, coords[i], image);
+}
+
+Vector4f Texture::Sample(Sampler sampler, Vector2f coord, Vector2f ddx, Vector2f ddy)const {
+	if (sampler.mipFilter == Sampler::MipFilter::None || subresourceCount == 1)
+		return SampleImage(sampler, coord, 0);
+
+	//The longer axis of the pixel footprint, in texels of the most detailed level
+	auto& image = images[0];
+	float dudx = ddx.x * image.width, dvdx = ddx.y * image.height;
+	float dudy = ddy.x * image.width, dvdy = ddy.y * image.height;
+	float footprint = max(dudx * dudx + dvdx * dvdx, dudy * dudy + dvdy * dvdy);
+	return SampleLevel(sampler, coord, 0.5f * log2f(footprint));
+}
+
+Vector4f Texture::SampleLevel(Sampler sampler, Vector2f coord, float lod)const {
+	lod = min(max(lod, 0.0f), (float)(subresourceCount - 1));
+
+	switch (sampler.mipFilter) {
+	case Sampler::MipFilter::Nearest:
+		return SampleImage(sampler, coord, (size_t)(lod + 0.5f));
+	case Sampler::MipFilter::Linear: {
+		size_t level = (size_t)lod;
+		float percent = lod - level;
+		Vector4f color = SampleImage(sampler, coord, level);
+		if (percent > 0.0f)
+			color = Lerp(color, SampleImage(sampler, coord, level + 1), percent);
+		return color;
+	}
+	default:
+		return SampleImage(sampler, coord, 0);
+	}
+}
+
+Vector4f Texture::SampleImage(const Sampler& sampler, Vector2f coord, size_t level)const {
+	if (level < residentLevel) {
+		requestedLevel = std::min(requestedLevel, level);
+		level = residentLevel;
+	}
+	auto& image = images[level];
+	return sampler.variant[VariantIndex(image)](sampler, coord, image);
+}
+
+//Texel space position of coord along an axis of size texels. Border has been handled by the caller and reads as Clamp
+template<Sampler::AddressMode addressMode> static float AddressCoord(float coord, uint32_t size) {
+	if (addressMode == Sampler::AddressMode::Repeat) {
+		coord = coord - floorf(coord);
+	}
+	else if (addressMode == Sampler::AddressMode::Mirror) {
+		//Period two: the fraction of coord / 2 rises over [0, 2) and folds back at one
+		float half = 0.5f * coord;
+		coord = 1.0f - fabsf(1.0f - 2.0f * (half - floorf(half)));
+	}
+	else {
+		coord = min(max(coord, 0.0f), 1.0f);
+	}
+	return coord * (float)size;
+}
+
+//Moves a texel index in [-1, size] inside the image, Repeat wraps to the opposite edge and the other modes clamp
+template<Sampler::AddressMode addressMode> static uint32_t AddressTexel(int texel, uint32_t size) {
+	if (addressMode == Sampler::AddressMode::Repeat) {
+		if ((size & (size - 1)) == 0)
+			return (uint32_t)texel & (size - 1);
+		texel = texel < 0 ? texel + (int)size : texel;
+		return (uint32_t)(texel >= (int)size ? texel - (int)size : texel);
 	}
-	return coord;
+	return (uint32_t)std::min(std::max(texel, 0), (int)size - 1);
+}
+
+template<TextureFormat format, TextureLayout layout, Sampler::Filter filter, Sampler::AddressMode addressModeU, Sampler::AddressMode addressModeV>
+static Vector4f SampleImage(const Sampler& sampler, Vector2f coord, const Image& image) {
+	//Images are stored top row first. Every address mode is symmetric about one half, so flipping first is the same as after
+	coord.y = 1.0f - coord.y;
+	if ((addressModeU == Sampler::AddressMode::Border && (coord.x < 0.0f || coord.x > 1.0f)) ||
+		(addressModeV == Sampler::AddressMode::Border && (coord.y < 0.0f || coord.y > 1.0f)))
+		return sampler.GetBorderColor();
+
+	float x = AddressCoord<addressModeU>(coord.x, image.width);
+	float y = AddressCoord<addressModeV>(coord.y, image.height);
+
+	if (filter == Sampler::Filter::Nearest) {
+		uint32_t texel[1];
+		FetchTexels<format, layout>(image, { AddressTexel<addressModeU>((int)x, image.width) },
+			{ AddressTexel<addressModeV>((int)y, image.height) }, texel);
+		return UnpackTexel(texel[0]);
+	}
+
+	//Texel centers sit at half texels
+	x -= 0.5f;
+	y -= 0.5f;
+
+	int x0 = (int)floorf(x), y0 = (int)floorf(y);
+	int weightX = (int)((x - x0) * (float)filterOne + 0.5f);
+	int weightY = (int)((y - y0) * (float)filterOne + 0.5f);
+	uint32_t left = AddressTexel<addressModeU>(x0, image.width), right = AddressTexel<addressModeU>(x0 + 1, image.width);
+	uint32_t top = AddressTexel<addressModeV>(y0, image.height), bottom = AddressTexel<addressModeV>(y0 + 1, image.height);
+
+	uint32_t texels[4];
+	FetchTexels<format, layout>(image, { left, right, left, right }, { top, top, bottom, bottom }, texels);
+	return FilterBilinear(texels[0], texels[1], texels[2], texels[3], weightX, weightY);
+}
+
+template<Sampler::Filter filter, Sampler::AddressMode addressModeU, Sampler::AddressMode addressModeV>
+constexpr Sampler::SampleFunction sampleVariants[] = {
+	SampleImage<TextureFormat::RGBA8, TextureLayout::Linear, filter, addressModeU, addressModeV>,
+	SampleImage<TextureFormat::RGBA8, TextureLayout::Tiled4x4, filter, addressModeU, addressModeV>,
+	SampleImage<TextureFormat::RGBA8, TextureLayout::Morton, filter, addressModeU, addressModeV>,
+	SampleImage<TextureFormat::BC1, TextureLayout::Linear, filter, addressModeU, addressModeV>,
+	SampleImage<TextureFormat::BC3, TextureLayout::Linear, filter, addressModeU, addressModeV>,
+	SampleImage<TextureFormat::R8, TextureLayout::Linear, filter, addressModeU, addressModeV>,
+	SampleImage<TextureFormat::R8, TextureLayout::Tiled4x4, filter, addressModeU, addressModeV>,
+	SampleImage<TextureFormat::R8, TextureLayout::Morton, filter, addressModeU, addressModeV>,
+	SampleImage<TextureFormat::RG8, TextureLayout::Linear, filter, addressModeU, addressModeV>,
+	SampleImage<TextureFormat::RG8, TextureLayout::Tiled4x4, filter, addressModeU, addressModeV>,
+	SampleImage<TextureFormat::RG8, TextureLayout::Morton, filter, addressModeU, addressModeV>,
+	SampleImage<TextureFormat::RGB565, TextureLayout::Linear, filter, addressModeU, addressModeV>,
+	SampleImage<TextureFormat::RGB565, TextureLayout::Tiled4x4, filter, addressModeU, addressModeV>,
+	SampleImage<TextureFormat::RGB565, TextureLayout::Morton, filter, addressModeU, addressModeV>
+};
+
+template<Sampler::Filter filter, Sampler::AddressMode addressModeU>
+static const Sampler::SampleFunction* FindSampleVariant(Sampler::AddressMode addressModeV) {
+	switch (addressModeV) {
+	case Sampler::AddressMode::Mirror:
+		return sampleVariants<filter, addressModeU, Sampler::AddressMode::Mirror>;
+	case Sampler::AddressMode::Clamp:
+		return sampleVariants<filter, addressModeU, Sampler::AddressMode::Clamp>;
+	case Sampler::AddressMode::Border:
+		return sampleVariants<filter, addressModeU, Sampler::AddressMode::Border>;
+	default:
+		return sampleVariants<filter, addressModeU, Sampler::AddressMode::Repeat>;
+	}
+}
+
+template<Sampler::Filter filter>
+static const Sampler::SampleFunction* FindSampleVariant(Sampler::AddressMode addressModeU, Sampler::AddressMode addressModeV) {
+	switch (addressModeU) {
+	case Sampler::AddressMode::Mirror:
+		return FindSampleVariant<filter, Sampler::AddressMode::Mirror>(addressModeV);
+	case Sampler::AddressMode::Clamp:
+		return FindSampleVariant<filter, Sampler::AddressMode::Clamp>(addressModeV);
+	case Sampler::AddressMode::Border:
+		return FindSampleVariant<filter, Sampler::AddressMode::Border>(addressModeV);
+	default:
+		return FindSampleVariant<filter, Sampler::AddressMode::Repeat>(addressModeV);
+	}
+}
+
+void Sampler::SelectVariant() {
+	if (filter == Filter::Linear)
+		variant = FindSampleVariant<Filter::Linear>(addressModeU, addressModeV);
+	else
+		variant = FindSampleVariant<Filter::Nearest>(addressModeU, addressModeV);
 }
\ No newline at end of file
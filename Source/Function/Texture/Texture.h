@@ -3,33 +3,118 @@
 #include "stb/stb_image.h"
 
 class Sampler;
+class TextureManager;
+class TextureCache;
+class MappedFile;
+
+//Texel order inside an image. Tiled4x4 stores every 4x4 block contiguously and Morton interleaves the bits of x and y,
+//so the texels of a bilinear footprint share cache lines in any direction instead of only along rows.
+//Tiled4x4 pads both sides to a multiple of 4, Morton pads both sides to a power of two
+enum class TextureLayout {
+	Linear = 0,
+	Tiled4x4,
+	Morton
+};
+
+//Storage format of the texels. BC1 (4 bits per texel, 1 bit alpha) and BC3 (8 bits per texel) store 4x4 blocks in row order,
+//the blocks are decoded when sampled and the layout does not apply to them.
+//R8 reads as (r, r, r, 1) and RG8 as (r, r, r, g), the way stb_image expands grey and grey-alpha files, so storing a file
+//with its own channel count samples exactly like RGBA8. RGB565 reads with alpha one
+enum class TextureFormat {
+	RGBA8 = 0,
+	BC1,
+	BC3,
+	R8,
+	RG8,
+	RGB565
+};
+
+//Wall clock time one texture of a batch load spent on each step
+struct TextureLoadTime {
+	double decodeMilliseconds{ 0.0 };
+	double mipMilliseconds{ 0.0 };
+};
 
 struct Image {
 	uint32_t width{ 0 }, height{ 0 }, BPP{ 32 };
 	uint64_t imageSize{ 0 };
 	stbi_uc* source{ nullptr };
+	TextureLayout layout{ TextureLayout::Linear };
+	TextureFormat format{ TextureFormat::RGBA8 };
+	//False when source points into a memory-mapped cache file, which is unmapped as a whole
+	bool ownsSource{ true };
 };
 
 class Texture {
 public:
 	Texture() { images = new Image[1]; }
 	Texture(size_t subresourceCount) : subresourceCount(subresourceCount) { images = new Image[subresourceCount]; }
-	Texture(const char* path, uint32_t BPP) { LoadImageWithSTB(path, BPP); }
+	Texture(const char* path, uint32_t BPP) { images = new Image[1]; LoadImageWithSTB(path, BPP); }
 	void Release();
 
+	//BPP picks the channels kept: 8 loads R8, 16 RG8, 24 or 32 RGBA8 and 0 the channel count of the file,
+	//with three channel files as RGBA8
 	void LoadImageWithSTB(const char* path, uint32_t BPP, size_t subresource);
 	void LoadImageWithSTB(const char* path, uint32_t BPP);
+	//Decodes an image file that is already in memory, BPP as for LoadImageWithSTB
+	void LoadImageWithSTB(const stbi_uc* file, size_t fileSize, uint32_t BPP, size_t subresource);
+	//Loads paths[i] into textures[i] concurrently on the JobSystem, one texture per job, and builds each mip chain on the
+	//worker that decoded it. times receives one entry per texture when not null. Must not be called from inside a job
+	static void LoadBatchWithSTB(Texture* const* textures, const char* const* paths, size_t count, uint32_t BPP,
+		bool generateMips, TextureLoadTime* times = nullptr);
+	//source is already in the given layout, as written by a capture. A null source only describes the level (an evicted one)
+	void LoadImageFromMemory(uint32_t width, uint32_t height, uint32_t BPP, const stbi_uc* source, size_t subresource,
+		TextureLayout layout = TextureLayout::Linear, TextureFormat format = TextureFormat::RGBA8);
+	//Replaces the subresources with the full mip chain of subresource 0, each level resized from the one above with stb_image_resize
+	void GenerateMips();
+	//Reorders the texels of every subresource, mips generated afterwards keep the layout. Compressed subresources are skipped
+	void SetLayout(TextureLayout layout);
+	TextureLayout GetLayout()const { return images[0].layout; }
+	//Converts every subresource, compressing with stb_dxt or decoding the blocks back to RGBA8. R8 keeps red, RG8 red
+	//and alpha, RGB565 rounds to 5:6:5, other conversions go through RGBA8
+	void SetFormat(TextureFormat format);
+	TextureFormat GetFormat()const { return images[0].format; }
+
+	//Frees every level more detailed than level, sampling falls back to level for them
+	void Evict(size_t level);
+	size_t GetResidentLevel()const { return residentLevel; }
+	//Most detailed level that sampling fell back from, SIZE_MAX when every sampled level was resident
+	size_t GetRequestedLevel()const { return requestedLevel; }
 
+	size_t GetSubresourceCount()const { return subresourceCount; }
+	//Bytes of one subresource, the padding of the layout included
+	static uint64_t CalcImageSize(uint32_t width, uint32_t height, TextureLayout layout, TextureFormat format);
+	//Compressed formats average over a block
+	static uint32_t GetFormatBPP(TextureFormat format);
+	const Image& GetImage(size_t subresource)const { return images[subresource]; }
+
+	//Samples the most detailed level only
 	Vector4f Sample(Sampler sampler, Vector2f coord)const;
+	//Samples count coordinates from the most detailed level with the layout resolved once for the whole batch
+	void Sample(Sampler sampler, const Vector2f* coords, size_t count, Vector4f* colors)const;
+	//Selects the level from the screen space derivatives of coord
+	Vector4f Sample(Sampler sampler, Vector2f coord, Vector2f ddx, Vector2f ddy)const;
+	Vector4f SampleLevel(Sampler sampler, Vector2f coord, float lod)const;
 
 private:
+	//Calls the sampler variant for the layout of the level, or of the resident level when level was evicted
+	Vector4f SampleImage(const Sampler& sampler, Vector2f coord, size_t level)const;
+
+	friend class TextureManager;
+	friend class TextureCache;
+
 	size_t subresourceCount{ 1 };
 	Image* images{ nullptr };
+	//Backs the images loaded from a TextureCache
+	MappedFile* mapping{ nullptr };
+	size_t residentLevel{ 0 };
+	//Written while sampling, which runs on one thread
+	mutable size_t requestedLevel{ SIZE_MAX };
 };
 
 class Sampler {
 public:
-	Sampler() {}
+	Sampler() { SelectVariant(); }
 
 	enum class Filter {
 		Nearest = 0,
@@ -41,19 +126,39 @@ public:
 		Clamp,
 		Border
 	};
+	//None always samples the most detailed level, Linear blends the two nearest levels (trilinear with Filter::Linear)
+	enum class MipFilter {
+		None = 0,
+		Nearest,
+		Linear
+	};
 
 	friend class Texture;
 
 	Sampler(Filter filter, AddressMode addressModeU, AddressMode addressModeV)
-	: filter(filter), addressModeU(addressModeU), addressModeV(addressModeV) {}
+	: filter(filter), addressModeU(addressModeU), addressModeV(addressModeV) { SelectVariant(); }
 
 	void SetBorderColor(Vector4f color) { borderColor = color; }
+	void SetMipFilter(MipFilter mipFilter) { this->mipFilter = mipFilter; }
+
+	Filter GetFilter()const { return filter; }
+	MipFilter GetMipFilter()const { return mipFilter; }
+	AddressMode GetAddressModeU()const { return addressModeU; }
+	AddressMode GetAddressModeV()const { return addressModeV; }
+	Vector4f GetBorderColor()const { return borderColor; }
+
+	//Sampling of one image specialized for the filter, both address modes and the texel storage
+	using SampleFunction = Vector4f(*)(const Sampler& sampler, Vector2f coord, const Image& image);
 
 private:
-	float Address(AddressMode addressMode, float coord)const;
+	//Picks the variants for the current state, in TextureFormat order one per layout of each uncompressed format
+	//and one per compressed format, so the fragment loop runs no switch on the sampler state
+	void SelectVariant();
 
 	Filter filter{ Filter::Nearest };
+	MipFilter mipFilter{ MipFilter::None };
 	AddressMode addressModeU{ AddressMode::Repeat };
 	AddressMode addressModeV{ AddressMode::Repeat };
 	Vector4f borderColor{ Vector4f(0.0f, 0.0f, 0.0f, 0.0f) };
+	const SampleFunction* variant{ nullptr };
 };
\ No newline at end of file
@@ -0,0 +1,238 @@
+#include "TextureAtlas.h"
+#include "Function/Texture/TextureCache.h"
+#define STB_RECT_PACK_IMPLEMENTATION
+#define STBRP_STATIC
+#include "stb/stb_rect_pack.h"
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+
+//Bumped whenever the manifest or the packing changes, old manifests then rebuild the pages
+const uint32_t manifestVersion = 1;
+const uint32_t manifestMagic = 0x534c5441;    //"ATLS"
+
+struct ManifestHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+	uint64_t pageCount;
+	uint64_t regionCount;
+};
+
+struct ManifestRegion {
+	uint64_t page;
+	float offsetX, offsetY;
+	float scaleX, scaleY;
+};
+
+static std::string PageFilePath(const std::string& directory, size_t page) {
+	char name[32];
+	snprintf(name, sizeof(name), "/Atlas%zu.tga", page);
+	return directory + name;
+}
+
+static std::string ManifestFilePath(const std::string& directory) {
+	return directory + "/Atlas.manifest";
+}
+
+//False unless the manifest was written under key for regionCount regions and every page it lists exists
+static bool ReadManifest(const std::string& directory, uint64_t key, size_t regionCount, std::vector<TextureAtlas::Region>& regions, size_t& pageCount) {
+	FILE* file = fopen(ManifestFilePath(directory).c_str(), "rb");
+	if (!file)
+		return false;
+
+	ManifestHeader header;
+	std::vector<ManifestRegion> manifestRegions(regionCount);
+	bool read = fread(&header, sizeof(header), 1, file) == 1 && header.magic == manifestMagic && header.version == manifestVersion &&
+		header.key == key && header.regionCount == regionCount &&
+		fread(manifestRegions.data(), sizeof(ManifestRegion), regionCount, file) == regionCount;
+	fclose(file);
+
+	for (size_t i = 0; read && i < regionCount; i++) {
+		auto& region = manifestRegions[i];
+		read = region.page == UINT64_MAX || region.page < header.pageCount;
+		regions[i].page = region.page == UINT64_MAX ? SIZE_MAX : (size_t)region.page;
+		regions[i].offset = Vector2f(region.offsetX, region.offsetY);
+		regions[i].scale = Vector2f(region.scaleX, region.scaleY);
+	}
+	for (size_t page = 0; read && page < header.pageCount; page++) {
+		FILE* pageFile = fopen(PageFilePath(directory, page).c_str(), "rb");
+		read = pageFile != nullptr;
+		if (pageFile)
+			fclose(pageFile);
+	}
+	pageCount = read ? (size_t)header.pageCount : 0;
+	return read;
+}
+
+//Written after the pages, so a build that stops halfway leaves no manifest that matches
+static bool WriteManifest(const std::string& directory, uint64_t key, size_t pageCount, const std::vector<TextureAtlas::Region>& regions) {
+	FILE* file = fopen(ManifestFilePath(directory).c_str(), "wb");
+	if (!file)
+		return false;
+
+	ManifestHeader header{ manifestMagic, manifestVersion, key, pageCount, regions.size() };
+	std::vector<ManifestRegion> manifestRegions;
+	for (auto& region : regions) {
+		manifestRegions.push_back({ region.page == SIZE_MAX ? UINT64_MAX : (uint64_t)region.page,
+			region.offset.x, region.offset.y, region.scale.x, region.scale.y });
+	}
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(manifestRegions.data(), sizeof(ManifestRegion), manifestRegions.size(), file) == manifestRegions.size();
+	written = fclose(file) == 0 && written;
+	if (!written)
+		remove(ManifestFilePath(directory).c_str());
+	return written;
+}
+
+//Uncompressed 32 bit TGA with the top row first, which stb_image reads back without an encoder on this side
+static bool WriteTGA(const std::string& path, uint32_t width, uint32_t height, const stbi_uc* texels) {
+	FILE* file = fopen(path.c_str(), "wb");
+	if (!file)
+		return false;
+
+	uint8_t header[18] = {};
+	header[2] = 2;
+	header[12] = (uint8_t)width;
+	header[13] = (uint8_t)(width >> 8);
+	header[14] = (uint8_t)height;
+	header[15] = (uint8_t)(height >> 8);
+	header[16] = 32;
+	header[17] = 0x28;
+	bool written = fwrite(header, sizeof(header), 1, file) == 1;
+
+	//TGA stores BGRA
+	std::vector<stbi_uc> row((size_t)width * 4);
+	for (uint32_t y = 0; y < height && written; y++) {
+		const stbi_uc* texel = texels + (size_t)y * width * 4;
+		for (uint32_t x = 0; x < width; x++, texel += 4) {
+			row[x * 4 + 0] = texel[2];
+			row[x * 4 + 1] = texel[1];
+			row[x * 4 + 2] = texel[0];
+			row[x * 4 + 3] = texel[3];
+		}
+		written = fwrite(row.data(), 1, row.size(), file) == row.size();
+	}
+	return fclose(file) == 0 && written;
+}
+
+TextureAtlas::TextureAtlas(uint32_t pageSize, uint32_t maxTextureSize, uint32_t padding)
+	: pageSize(pageSize), maxTextureSize(std::min(maxTextureSize, pageSize - 2 * padding)), padding(padding) {}
+
+bool TextureAtlas::Build(const std::vector<std::string>& paths, const std::string& directory) {
+	std::vector<std::string> uniquePaths;
+	std::unordered_map<std::string, size_t> pathIndices;
+	regionIndices.clear();
+	for (auto& path : paths) {
+		auto inserted = pathIndices.emplace(path, uniquePaths.size());
+		if (inserted.second)
+			uniquePaths.push_back(path);
+		regionIndices.push_back(inserted.first->second);
+	}
+	uniqueRegions.assign(uniquePaths.size(), Region());
+	pagePaths.clear();
+
+	//Sources that do not exist key as zero, so they rebuild the pages once they appear
+	std::vector<uint64_t> keys = { pageSize, maxTextureSize, padding };
+	for (auto& path : uniquePaths) {
+		uint64_t sourceKey = 0;
+		TextureCache::GetSourceKey(path, TextureCache::Options(), sourceKey);
+		keys.push_back(sourceKey);
+	}
+	uint64_t key = TextureCache::Hash(reinterpret_cast<const uint8_t*>(keys.data()), keys.size() * sizeof(uint64_t), TextureCache::Options());
+	size_t pageCount = 0;
+	if (ReadManifest(directory, key, uniquePaths.size(), uniqueRegions, pageCount)) {
+		for (size_t page = 0; page < pageCount; page++)
+			pagePaths.push_back(PageFilePath(directory, page));
+		return true;
+	}
+	uniqueRegions.assign(uniquePaths.size(), Region());
+
+	std::vector<std::unique_ptr<Texture>> textures;
+	std::vector<Texture*> texturePointers;
+	std::vector<const char*> pathPointers;
+	for (auto& path : uniquePaths) {
+		textures.push_back(std::make_unique<Texture>());
+		texturePointers.push_back(textures.back().get());
+		pathPointers.push_back(path.c_str());
+	}
+	Texture::LoadBatchWithSTB(texturePointers.data(), pathPointers.data(), uniquePaths.size(), 32, false);
+
+	//Padded sizes are rounded to padding, so every region starts on a multiple of it
+	std::vector<stbrp_rect> rects;
+	for (size_t i = 0; i < uniquePaths.size(); i++) {
+		auto& image = textures[i]->GetImage(0);
+		if (!image.source || image.width > maxTextureSize || image.height > maxTextureSize)
+			continue;
+		stbrp_rect rect = {};
+		rect.id = (int)i;
+		rect.w = (stbrp_coord)((image.width + 3 * padding - 1) & ~(padding - 1));
+		rect.h = (stbrp_coord)((image.height + 3 * padding - 1) & ~(padding - 1));
+		rects.push_back(rect);
+	}
+
+	bool written = true;
+	std::vector<stbrp_node> nodes(pageSize);
+	while (!rects.empty()) {
+		stbrp_context context;
+		stbrp_init_target(&context, (int)pageSize, (int)pageSize, nodes.data(), (int)nodes.size());
+		stbrp_pack_rects(&context, rects.data(), (int)rects.size());
+		bool packed = false;
+		for (auto& rect : rects)
+			packed = packed || rect.was_packed;
+		if (!packed)
+			break;
+
+		//The page is cut down to the rows in use
+		uint32_t pageHeight = 0;
+		for (auto& rect : rects) {
+			if (rect.was_packed)
+				pageHeight = std::max(pageHeight, (uint32_t)(rect.y + rect.h));
+		}
+		std::vector<stbi_uc> texels((size_t)pageSize * pageHeight * 4, 0);
+
+		size_t page = pagePaths.size();
+		std::vector<stbrp_rect> remaining;
+		for (auto& rect : rects) {
+			if (!rect.was_packed) {
+				remaining.push_back(rect);
+				continue;
+			}
+
+			//Texels outside the image repeat its nearest edge texel
+			auto& image = textures[rect.id]->GetImage(0);
+			uint32_t left = rect.x + padding, top = rect.y + padding;
+			for (uint32_t y = rect.y; y < (uint32_t)(rect.y + rect.h); y++) {
+				uint32_t sourceY = (uint32_t)std::min(std::max((int)y - (int)top, 0), (int)image.height - 1);
+				for (uint32_t x = rect.x; x < (uint32_t)(rect.x + rect.w); x++) {
+					uint32_t sourceX = (uint32_t)std::min(std::max((int)x - (int)left, 0), (int)image.width - 1);
+					memcpy(texels.data() + ((size_t)y * pageSize + x) * 4, image.source + ((size_t)sourceY * image.width + sourceX) * 4, 4);
+				}
+			}
+
+			//Images are stored top row first while v points up
+			auto& region = uniqueRegions[rect.id];
+			region.page = page;
+			region.scale = Vector2f((float)image.width / (float)pageSize, (float)image.height / (float)pageHeight);
+			region.offset = Vector2f((float)left / (float)pageSize, 1.0f - (float)(top + image.height) / (float)pageHeight);
+		}
+
+		pagePaths.push_back(PageFilePath(directory, page));
+		written = WriteTGA(pagePaths.back(), pageSize, pageHeight, texels.data()) && written;
+		rects = std::move(remaining);
+	}
+
+	for (auto& texture : textures)
+		texture->Release();
+	return written && WriteManifest(directory, key, pagePaths.size(), uniqueRegions);
+}
+
+bool TextureAtlas::FitsRegion(const Vertex* vertices, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		const Vector2f& texCoord = vertices[i].texCoord;
+		if (texCoord.x < 0.0f || texCoord.x > 1.0f || texCoord.y < 0.0f || texCoord.y > 1.0f)
+			return false;
+	}
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,49 @@
+#pragma once
+#include "Function/Texture/Texture.h"
+#include <string>
+#include <vector>
+
+//Packs small textures into shared pages with stb_rect_pack at import time, so meshes that used different textures can
+//bind one page and be drawn together. Every texture is surrounded by padding texels that repeat its edges, and regions
+//start on multiples of padding, so bilinear filtering does not bleed between neighbours in the levels where padding
+//is still at least one texel (log2(padding) + 1 levels). Coarser mips blend neighbours like any atlas.
+//Texture coordinates are remapped into the region, which only holds for coordinates inside [0, 1]: a region can not
+//repeat, and its edges filter like Clamp where the whole texture would have wrapped
+class TextureAtlas {
+public:
+	//Where a packed texture ended up, page is SIZE_MAX for textures that were left alone
+	struct Region {
+		size_t page{ SIZE_MAX };
+		Vector2f offset{ 0.0f, 0.0f };
+		Vector2f scale{ 1.0f, 1.0f };
+
+		Vector2f Transform(Vector2f texCoord)const { return Vector2f(offset.x + texCoord.x * scale.x, offset.y + texCoord.y * scale.y); }
+	};
+
+	//padding has to be a power of two. Textures wider or taller than maxTextureSize stay on their own
+	TextureAtlas(uint32_t pageSize = 2048, uint32_t maxTextureSize = 512, uint32_t padding = 8);
+
+	//Decodes paths concurrently on the JobSystem and packs every texture that is small enough into as few pages as
+	//possible, written as RGBA8 TGA files into directory. Repeated paths are packed once and share their region.
+	//Textures that can not be read stay on their own. A manifest next to the pages records the regions under a key of
+	//the path, size and modification time of every source, so when nothing changed the pages are reused without
+	//decoding and keep their timestamps, which lets TextureCache hit on them. False when a page can not be written
+	bool Build(const std::vector<std::string>& paths, const std::string& directory);
+
+	const Region& GetRegion(size_t index)const { return uniqueRegions[regionIndices[index]]; }
+	size_t GetPageCount()const { return pagePaths.size(); }
+	const std::string& GetPagePath(size_t page)const { return pagePaths[page]; }
+
+	//Whether all texCoords lie inside [0, 1], so remapping them into a region samples what the texture did
+	static bool FitsRegion(const Vertex* vertices, size_t count);
+
+private:
+	uint32_t pageSize;
+	uint32_t maxTextureSize;
+	uint32_t padding;
+	//Of the unique paths in the last Build
+	std::vector<Region> uniqueRegions;
+	//Indices into uniqueRegions, one per path given to Build
+	std::vector<size_t> regionIndices;
+	std::vector<std::string> pagePaths;
+};
\ No newline at end of file
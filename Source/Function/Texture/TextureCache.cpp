@@ -0,0 +1,381 @@
+#include "TextureCache.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+//Bumped whenever the file layout or the conversions change, old files then simply miss
+const uint32_t cacheVersion = 3;
+const uint32_t cacheMagic = 0x58545253;    //"SRTX"
+//Level data starts on cache line boundaries, levels of a page or more start on page boundaries so that evicting
+//them can hand all their pages back
+const uint64_t cacheAlignment = 64;
+const uint64_t cachePageSize = 4096;
+
+struct CacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t hash;
+	uint64_t subresourceCount;
+};
+
+struct CacheLevel {
+	uint32_t width, height, BPP;
+	TextureLayout layout;
+	TextureFormat format;
+	uint32_t padding;
+	uint64_t imageSize;
+	uint64_t offset;
+};
+
+MappedFile* MappedFile::Open(const std::string& path) {
+	const uint8_t* data = nullptr;
+	uint64_t size = 0;
+#if defined(_WIN32)
+	//The view keeps the file mapping alive, both handles can be closed right away
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return nullptr;
+	LARGE_INTEGER fileSize;
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping) {
+			data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+			size = (uint64_t)fileSize.QuadPart;
+			CloseHandle(mapping);
+		}
+	}
+	CloseHandle(file);
+#else
+	int file = open(path.c_str(), O_RDONLY);
+	if (file < 0)
+		return nullptr;
+	struct stat status;
+	if (fstat(file, &status) == 0 && status.st_size > 0) {
+		void* view = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_SHARED, file, 0);
+		if (view != MAP_FAILED) {
+			data = static_cast<const uint8_t*>(view);
+			size = (uint64_t)status.st_size;
+		}
+	}
+	close(file);
+#endif
+	if (!data)
+		return nullptr;
+
+	MappedFile* mappedFile = new MappedFile();
+	mappedFile->data = data;
+	mappedFile->size = size;
+	return mappedFile;
+}
+
+void MappedFile::Discard(const uint8_t* begin, uint64_t size)const {
+#if defined(_WIN32)
+	SYSTEM_INFO systemInfo;
+	GetSystemInfo(&systemInfo);
+	uint64_t pageSize = systemInfo.dwPageSize;
+#else
+	uint64_t pageSize = (uint64_t)sysconf(_SC_PAGESIZE);
+#endif
+	uint64_t first = ((uint64_t)(begin - data) + pageSize - 1) / pageSize * pageSize;
+	uint64_t last = std::min((uint64_t)(begin - data) + size, this->size) / pageSize * pageSize;
+	if (first >= last)
+		return;
+#if defined(_WIN32)
+	//Unlocking pages that are not locked removes them from the working set
+	VirtualUnlock(const_cast<uint8_t*>(data + first), (SIZE_T)(last - first));
+#else
+	//The mapping is shared and read only, dropped pages read back from the file if touched again
+	madvise(const_cast<uint8_t*>(data + first), (size_t)(last - first), MADV_DONTNEED);
+#endif
+}
+
+MappedFile::~MappedFile() {
+#if defined(_WIN32)
+	UnmapViewOfFile(data);
+#else
+	munmap(const_cast<uint8_t*>(data), (size_t)size);
+#endif
+}
+
+TextureCache::TextureCache(const std::string& directory) : directory(directory) {
+#if defined(_WIN32)
+	CreateDirectoryA(directory.c_str(), nullptr);
+#else
+	mkdir(directory.c_str(), 0755);
+#endif
+}
+
+//Moves from over to, replacing what is there. rename does that on POSIX but fails on Windows when to exists
+static bool MoveReplacing(const std::string& from, const std::string& to) {
+#if defined(_WIN32)
+	return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+//Unique name next to path, files are written there and moved into place so no process ever maps a partial file
+static std::string TemporaryPath(const std::string& path) {
+	char suffix[32];
+	snprintf(suffix, sizeof(suffix), ".%llx.tmp", (unsigned long long)std::chrono::steady_clock::now().time_since_epoch().count());
+	return path + suffix;
+}
+
+bool TextureCache::Load(const std::string& path, const Options& options, Texture& texture, bool* hit)const {
+	if (hit)
+		*hit = false;
+
+	//The key file of the path, size and modification time names the converted file without reading the source
+	uint64_t sourceKey = 0, hash = 0;
+	bool keyed = GetSourceKey(path, options, sourceKey);
+	if (keyed && ReadKey(GetKeyPath(sourceKey), hash) && Map(GetCachePath(hash), hash, texture)) {
+		if (hit)
+			*hit = true;
+		return true;
+	}
+
+	FILE* file = fopen(path.c_str(), "rb");
+	if (!file)
+		return false;
+	std::vector<uint8_t> data;
+	fseek(file, 0, SEEK_END);
+	long fileSize = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if (fileSize > 0) {
+		data.resize((size_t)fileSize);
+		data.resize(fread(data.data(), 1, data.size(), file));
+	}
+	fclose(file);
+
+	//A touched, copied or renamed source still finds its converted file by content
+	hash = Hash(data.data(), data.size(), options);
+	std::string cachePath = GetCachePath(hash);
+	if (Map(cachePath, hash, texture)) {
+		if (keyed)
+			WriteKey(GetKeyPath(sourceKey), hash);
+		if (hit)
+			*hit = true;
+		return true;
+	}
+
+	texture.Release();
+	texture.images = new Image[1];
+	texture.subresourceCount = 1;
+	texture.residentLevel = 0;
+	texture.requestedLevel = SIZE_MAX;
+	texture.LoadImageWithSTB(data.data(), data.size(), 0, 0);
+	if (!texture.GetImage(0).source)
+		return false;
+
+	if (options.generateMips)
+		texture.GenerateMips();
+	if (options.format != TextureFormat::RGBA8)
+		texture.SetFormat(options.format);
+	texture.SetLayout(options.layout);
+
+	//Mapping what was just written lets later processes share the same pages
+	if (Write(cachePath, hash, texture) && Map(cachePath, hash, texture) && keyed)
+		WriteKey(GetKeyPath(sourceKey), hash);
+	return true;
+}
+
+//64 bits at a time with xxHash64's round and avalanche, every option and the cache version go into the seed
+uint64_t TextureCache::Hash(const uint8_t* data, size_t size, const Options& options) {
+	const uint64_t prime1 = 0x9E3779B185EBCA87ull, prime2 = 0xC2B2AE3D27D4EB4Full, prime3 = 0x165667B19E3779F9ull;
+	auto rotate = [](uint64_t value, int bits) { return value << bits | value >> (64 - bits); };
+	auto round = [&](uint64_t hash, uint64_t value) { return rotate(hash ^ rotate(value * prime2, 31) * prime1, 27) * prime1 + prime3; };
+
+	uint64_t hash = (uint64_t)size * prime1;
+	hash = round(hash, cacheVersion);
+	hash = round(hash, (uint64_t)options.generateMips | (uint64_t)options.format << 8 | (uint64_t)options.layout << 16);
+
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t value;
+		memcpy(&value, data + i, sizeof(uint64_t));
+		hash = round(hash, value);
+	}
+	uint64_t tail = 0;
+	for (size_t j = 0; i < size; i++, j++)
+		tail |= (uint64_t)data[i] << 8 * j;
+	hash = round(hash, tail);
+
+	hash ^= hash >> 33;
+	hash *= prime2;
+	hash ^= hash >> 29;
+	hash *= prime3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+std::string TextureCache::GetCachePath(uint64_t hash)const {
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.tex", (unsigned long long)hash);
+	return directory + name;
+}
+
+std::string TextureCache::GetKeyPath(uint64_t sourceKey)const {
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.key", (unsigned long long)sourceKey);
+	return directory + name;
+}
+
+bool TextureCache::GetSourceKey(const std::string& path, const Options& options, uint64_t& sourceKey) {
+#if defined(_WIN32)
+	struct _stat64 status;
+	if (_stat64(path.c_str(), &status) != 0)
+		return false;
+#else
+	struct stat status;
+	if (stat(path.c_str(), &status) != 0)
+		return false;
+#endif
+	uint64_t stamp[2] = { (uint64_t)status.st_size, (uint64_t)status.st_mtime };
+	std::vector<uint8_t> key(path.begin(), path.end());
+	key.insert(key.end(), reinterpret_cast<const uint8_t*>(stamp), reinterpret_cast<const uint8_t*>(stamp + 2));
+	sourceKey = Hash(key.data(), key.size(), options);
+	return true;
+}
+
+bool TextureCache::ReadKey(const std::string& keyPath, uint64_t& hash) {
+	FILE* file = fopen(keyPath.c_str(), "rb");
+	if (!file)
+		return false;
+	uint64_t key[2];
+	bool read = fread(key, sizeof(key), 1, file) == 1 && key[0] == ((uint64_t)cacheMagic << 32 | cacheVersion);
+	fclose(file);
+	hash = key[1];
+	return read;
+}
+
+void TextureCache::WriteKey(const std::string& keyPath, uint64_t hash) {
+	std::string temporaryPath = TemporaryPath(keyPath);
+	FILE* file = fopen(temporaryPath.c_str(), "wb");
+	if (!file)
+		return;
+	uint64_t key[2] = { (uint64_t)cacheMagic << 32 | cacheVersion, hash };
+	bool written = fwrite(key, sizeof(key), 1, file) == 1;
+	written = fclose(file) == 0 && written;
+	if (!written || !MoveReplacing(temporaryPath, keyPath))
+		remove(temporaryPath.c_str());
+}
+
+bool TextureCache::Map(const std::string& cachePath, uint64_t hash, Texture& texture)const {
+	MappedFile* file = MappedFile::Open(cachePath);
+	if (!file)
+		return false;
+
+	//Anything inconsistent is treated as a miss and rewritten
+	const uint8_t* data = file->GetData();
+	uint64_t size = file->GetSize();
+	CacheHeader header;
+	bool valid = size >= sizeof(CacheHeader);
+	if (valid) {
+		memcpy(&header, data, sizeof(CacheHeader));
+		valid = header.magic == cacheMagic && header.version == cacheVersion && header.hash == hash && header.subresourceCount > 0 &&
+			header.subresourceCount <= (size - sizeof(CacheHeader)) / sizeof(CacheLevel);
+	}
+	std::vector<CacheLevel> levels;
+	if (valid) {
+		levels.resize((size_t)header.subresourceCount);
+		memcpy(levels.data(), data + sizeof(CacheHeader), levels.size() * sizeof(CacheLevel));
+		//Sampling trusts every field, so each level has to describe exactly the bytes it claims
+		for (auto& level : levels) {
+			bool compressed = level.format == TextureFormat::BC1 || level.format == TextureFormat::BC3;
+			valid = valid && level.offset <= size && level.imageSize <= size - level.offset && level.width > 0 && level.height > 0 &&
+				(uint32_t)level.format <= (uint32_t)TextureFormat::RGB565 && (uint32_t)level.layout <= (uint32_t)TextureLayout::Morton &&
+				(!compressed || level.layout == TextureLayout::Linear) && level.BPP == Texture::GetFormatBPP(level.format) &&
+				level.imageSize == Texture::CalcImageSize(level.width, level.height, level.layout, level.format);
+		}
+	}
+	if (!valid) {
+		delete file;
+		return false;
+	}
+
+	texture.Release();
+	texture.images = new Image[levels.size()];
+	texture.subresourceCount = levels.size();
+	texture.residentLevel = 0;
+	texture.requestedLevel = SIZE_MAX;
+	texture.mapping = file;
+	for (size_t i = 0; i < levels.size(); i++) {
+		auto& image = texture.images[i];
+		image.width = levels[i].width;
+		image.height = levels[i].height;
+		image.BPP = levels[i].BPP;
+		image.layout = levels[i].layout;
+		image.format = levels[i].format;
+		image.imageSize = levels[i].imageSize;
+		image.source = const_cast<stbi_uc*>(data + levels[i].offset);
+		image.ownsSource = false;
+	}
+	return true;
+}
+
+bool TextureCache::Restore(Texture& texture, size_t level) {
+	if (!texture.mapping)
+		return false;
+
+	//The level table was validated by Map, and the mapped file is never written in place
+	const uint8_t* data = texture.mapping->GetData();
+	for (size_t i = level; i < texture.residentLevel; i++) {
+		CacheLevel cacheLevel;
+		memcpy(&cacheLevel, data + sizeof(CacheHeader) + i * sizeof(CacheLevel), sizeof(CacheLevel));
+		texture.images[i].source = const_cast<stbi_uc*>(data + cacheLevel.offset);
+		texture.images[i].ownsSource = false;
+	}
+	texture.residentLevel = std::min(texture.residentLevel, level);
+	return true;
+}
+
+bool TextureCache::Write(const std::string& cachePath, uint64_t hash, const Texture& texture)const {
+	size_t subresourceCount = texture.GetSubresourceCount();
+	CacheHeader header{ cacheMagic, cacheVersion, hash, subresourceCount };
+	std::vector<CacheLevel> levels(subresourceCount);
+	uint64_t offset = sizeof(CacheHeader) + subresourceCount * sizeof(CacheLevel);
+	for (size_t i = 0; i < subresourceCount; i++) {
+		auto& image = texture.GetImage(i);
+		uint64_t alignment = image.imageSize >= cachePageSize ? cachePageSize : cacheAlignment;
+		offset = (offset + alignment - 1) & ~(alignment - 1);
+		levels[i] = { image.width, image.height, image.BPP, image.layout, image.format, 0, image.imageSize, offset };
+		offset += image.imageSize;
+	}
+
+	std::string temporaryPath = TemporaryPath(cachePath);
+	FILE* file = fopen(temporaryPath.c_str(), "wb");
+	if (!file)
+		return false;
+
+	bool written = fwrite(&header, sizeof(CacheHeader), 1, file) == 1 &&
+		fwrite(levels.data(), sizeof(CacheLevel), levels.size(), file) == levels.size();
+	uint64_t position = sizeof(CacheHeader) + subresourceCount * sizeof(CacheLevel);
+	static const uint8_t zeros[cachePageSize] = {};
+	for (size_t i = 0; i < subresourceCount && written; i++) {
+		written = fwrite(zeros, 1, (size_t)(levels[i].offset - position), file) == levels[i].offset - position &&
+			fwrite(texture.GetImage(i).source, 1, (size_t)levels[i].imageSize, file) == levels[i].imageSize;
+		position = levels[i].offset + levels[i].imageSize;
+	}
+	written = fclose(file) == 0 && written;
+
+	//Replaces a stale or damaged file. Losing the race to another process, or a file still mapped on Windows, leaves
+	//the file in place and the next load tries again
+	if (!written || !MoveReplacing(temporaryPath, cachePath)) {
+		remove(temporaryPath.c_str());
+		return written;
+	}
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,66 @@
+#pragma once
+#include "Function/Texture/Texture.h"
+#include <string>
+
+//Read-only view of a whole file, unmapped when deleted. Every process mapping the same file shares its pages
+class MappedFile {
+public:
+	//nullptr when the file can not be opened or is empty
+	static MappedFile* Open(const std::string& path);
+	~MappedFile();
+
+	//Hands the physical pages lying wholly inside [begin, begin + size) back to the system, they are read from the file
+	//again if touched later
+	void Discard(const uint8_t* begin, uint64_t size)const;
+
+	const uint8_t* GetData()const { return data; }
+	uint64_t GetSize()const { return size; }
+
+private:
+	MappedFile() {}
+
+	const uint8_t* data{ nullptr };
+	uint64_t size{ 0 };
+};
+
+//Decoded, mipmapped and converted textures on disk, one file per source named by a hash of the source file contents
+//and the conversion options, so an edited source or different options never hit a stale entry.
+//A small key file named by the path, size and modification time of the source points at that file, so a hit only
+//stats the source. When the key misses the source is read and hashed, which still hits after a touch or a copy.
+//An edit that keeps the size within the same second as the last conversion goes unnoticed.
+//Textures loaded through the cache point their levels straight into the mapped file, nothing is decoded or copied
+class TextureCache {
+public:
+	struct Options {
+		bool generateMips{ true };
+		//RGBA8 keeps the channel count of the file (R8, RG8 or RGBA8), which samples the same
+		TextureFormat format{ TextureFormat::RGBA8 };
+		TextureLayout layout{ TextureLayout::Linear };
+	};
+
+	//directory is created if it does not exist, its parent has to
+	TextureCache(const std::string& directory);
+
+	//Maps the cached conversion of path into texture. On a miss the source is decoded and converted, written to the
+	//cache and then mapped, if the cache can not be written texture keeps the converted data in memory.
+	//False when the source can not be read or decoded, texture is left empty then. Safe to call from several threads and processes
+	bool Load(const std::string& path, const Options& options, Texture& texture, bool* hit = nullptr)const;
+
+	//Points the evicted levels [level, resident level) of a texture loaded by the cache back into its mapping, which only
+	//costs page faults on first use. False when texture is not mapped, its levels are then gone until it is loaded again
+	static bool Restore(Texture& texture, size_t level);
+
+	static uint64_t Hash(const uint8_t* data, size_t size, const Options& options);
+	//Hash of the path, size and modification time of a source and options, false when the source does not exist
+	static bool GetSourceKey(const std::string& path, const Options& options, uint64_t& sourceKey);
+
+private:
+	std::string GetCachePath(uint64_t hash)const;
+	std::string GetKeyPath(uint64_t sourceKey)const;
+	static bool ReadKey(const std::string& keyPath, uint64_t& hash);
+	static void WriteKey(const std::string& keyPath, uint64_t hash);
+	bool Map(const std::string& cachePath, uint64_t hash, Texture& texture)const;
+	bool Write(const std::string& cachePath, uint64_t hash, const Texture& texture)const;
+
+	std::string directory;
+};
\ No newline at end of file
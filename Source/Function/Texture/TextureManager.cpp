@@ -0,0 +1,179 @@
+#include "TextureManager.h"
+#include "Core/Job/JobSystem.h"
+#include <chrono>
+#include <mutex>
+
+TextureManager::~TextureManager() {
+	for (auto& entry : entries) {
+		if (entry.texture)
+			entry.texture->Release();
+	}
+}
+
+size_t TextureManager::Register(const std::string& path) {
+	Entry entry;
+	entry.path = path;
+	entries.push_back(std::move(entry));
+	return entries.size() - 1;
+}
+
+Texture* TextureManager::Bind(size_t id) {
+	auto& entry = entries[id];
+	entry.lastUse = ++useCounter;
+
+	if (!entry.texture) {
+		bool hit = false;
+		std::unique_ptr<Texture> texture = Load(entry.path, &hit);
+		if (!texture)
+			return nullptr;
+		statistics.loads++;
+		statistics.cacheHits += hit;
+
+		uint64_t bytes = LevelBytes(*texture, 0, texture->GetSubresourceCount());
+		MakeRoom(bytes, id);
+		residentBytes += bytes;
+		entry.texture = std::move(texture);
+
+		//Whatever the others could not give up comes out of the new texture itself
+		while (residentBytes > budget && entry.texture->residentLevel + 1 < entry.texture->GetSubresourceCount())
+			EvictLevel(entry);
+		entry.texture->requestedLevel = SIZE_MAX;
+		return entry.texture.get();
+	}
+
+	Texture& texture = *entry.texture;
+	size_t residentLevel = texture.residentLevel;
+	size_t level = std::min(texture.requestedLevel, residentLevel);
+	texture.requestedLevel = SIZE_MAX;
+	//Only mapped levels come back without decoding the whole file again
+	if (!texture.mapping)
+		return &texture;
+
+	//The most detailed requested level that fits next to what the other textures can give up
+	uint64_t available = budget > residentBytes ? budget - residentBytes : 0;
+	available += EvictableBytes(id);
+	while (level < residentLevel && LevelBytes(texture, level, residentLevel) > available)
+		level++;
+	if (level == residentLevel)
+		return &texture;
+
+	//Room is made first, so the restored levels never take the resident bytes past the budget
+	uint64_t bytes = LevelBytes(texture, level, residentLevel);
+	MakeRoom(bytes, id);
+	TextureCache::Restore(texture, level);
+	residentBytes += bytes;
+	statistics.streamedLevels += residentLevel - level;
+	return &texture;
+}
+
+void TextureManager::Preload(std::vector<TextureLoadTime>* times) {
+	std::vector<size_t> ids;
+	for (size_t i = 0; i < entries.size(); i++) {
+		if (!entries[i].texture)
+			ids.push_back(i);
+	}
+
+	if (times)
+		times->assign(entries.size(), TextureLoadTime());
+	//Each texture joins the budget as soon as its job finishes, so beyond the budget there is at most the texture
+	//each worker is loading
+	std::mutex mutex;
+	JobSystem::Get().ParallelFor(ids.size(), 1, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			bool hit = false;
+			TextureLoadTime loadTime;
+			std::unique_ptr<Texture> texture = Load(entries[ids[i]].path, &hit, &loadTime);
+			//Left for Bind to retry
+			if (!texture)
+				continue;
+
+			std::lock_guard<std::mutex> lock(mutex);
+			auto& entry = entries[ids[i]];
+			statistics.loads++;
+			statistics.cacheHits += hit;
+			entry.lastUse = ++useCounter;
+			residentBytes += LevelBytes(*texture, 0, texture->GetSubresourceCount());
+			entry.texture = std::move(texture);
+			MakeRoom(0, SIZE_MAX);
+			if (times)
+				(*times)[ids[i]] = loadTime;
+		}
+	});
+}
+
+void TextureManager::SetBudget(uint64_t budget) {
+	this->budget = budget;
+	MakeRoom(0, SIZE_MAX);
+}
+
+std::unique_ptr<Texture> TextureManager::Load(const std::string& path, bool* hit, TextureLoadTime* time)const {
+	std::unique_ptr<Texture> texture = std::make_unique<Texture>();
+	auto start = std::chrono::steady_clock::now();
+	if (cache) {
+		TextureCache::Options options;
+		options.format = format;
+		if (!cache->Load(path, options, *texture, hit)) {
+			texture->Release();
+			return nullptr;
+		}
+		if (time)
+			time->decodeMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		return texture;
+	}
+
+	texture->LoadImageWithSTB(path.c_str(), 0);
+	if (!texture->GetImage(0).source) {
+		texture->Release();
+		return nullptr;
+	}
+	auto decoded = std::chrono::steady_clock::now();
+	texture->GenerateMips();
+	if (format != TextureFormat::RGBA8)
+		texture->SetFormat(format);
+	if (time) {
+		time->decodeMilliseconds = std::chrono::duration<double, std::milli>(decoded - start).count();
+		time->mipMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - decoded).count();
+	}
+	return texture;
+}
+
+uint64_t TextureManager::LevelBytes(const Texture& texture, size_t first, size_t last) {
+	uint64_t bytes = 0;
+	for (size_t i = first; i < last; i++) {
+		bytes += texture.GetImage(i).imageSize;
+	}
+	return bytes;
+}
+
+uint64_t TextureManager::EvictableBytes(size_t keep)const {
+	uint64_t bytes = 0;
+	for (size_t i = 0; i < entries.size(); i++) {
+		auto& texture = entries[i].texture;
+		if (i != keep && texture)
+			bytes += LevelBytes(*texture, texture->residentLevel, texture->GetSubresourceCount() - 1);
+	}
+	return bytes;
+}
+
+void TextureManager::EvictLevel(Entry& entry) {
+	Texture& texture = *entry.texture;
+	residentBytes -= texture.GetImage(texture.residentLevel).imageSize;
+	texture.Evict(texture.residentLevel + 1);
+	statistics.evictedLevels++;
+}
+
+void TextureManager::MakeRoom(uint64_t bytes, size_t keep) {
+	while (residentBytes + bytes > budget) {
+		Entry* victim = nullptr;
+		for (size_t i = 0; i < entries.size(); i++) {
+			auto& entry = entries[i];
+			if (i == keep || !entry.texture || entry.texture->residentLevel + 1 >= entry.texture->GetSubresourceCount())
+				continue;
+			if (!victim || entry.lastUse < victim->lastUse)
+				victim = &entry;
+		}
+		if (!victim)
+			return;
+		EvictLevel(*victim);
+	}
+}
\ No newline at end of file
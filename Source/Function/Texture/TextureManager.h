@@ -0,0 +1,71 @@
+#pragma once
+#include "Function/Texture/Texture.h"
+#include "Function/Texture/TextureCache.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+//Loads textures on first bind and keeps the bytes of their resident mip levels within a budget. When room is needed,
+//the least recently bound textures give up their most detailed resident level first, down to their last level.
+//Sampling an evicted level falls back to the resident one and records the request. With a cache the next bind of that
+//texture maps the missing levels back as far as the budget allows. Without one nothing is decoded on the render
+//thread, evicted levels stay gone until the texture is loaded again
+class TextureManager {
+public:
+	//RGBA8 keeps each texture in the compact format of its channel count (R8, RG8 or RGBA8), compressed formats convert all
+	TextureManager(uint64_t budget, TextureFormat format = TextureFormat::RGBA8) : budget(budget), format(format) {}
+	~TextureManager();
+
+	//Nothing is read until the texture is first bound
+	size_t Register(const std::string& path);
+	//nullptr when the file can not be read. The texture stays owned by the manager and keeps its address
+	Texture* Bind(size_t id);
+	//Loads every registered texture that is not loaded yet concurrently on the JobSystem. Each one is counted and the
+	//others evicted as soon as it is loaded, so the budget holds throughout apart from the textures still loading.
+	//times receives one entry per registered texture when not null
+	void Preload(std::vector<TextureLoadTime>* times = nullptr);
+
+	//Loads through cache from then on, which stays owned by the caller. Cached textures map their levels from the
+	//cache file instead of decoding, which is what lets evicted levels stream back
+	void SetCache(const TextureCache* cache) { this->cache = cache; }
+
+	//A lower budget takes effect by evicting right away
+	void SetBudget(uint64_t budget);
+	uint64_t GetBudget()const { return budget; }
+	uint64_t GetResidentBytes()const { return residentBytes; }
+	size_t GetTextureCount()const { return entries.size(); }
+
+	struct Statistics {
+		uint64_t loads{ 0 };
+		uint64_t cacheHits{ 0 };
+		uint64_t evictedLevels{ 0 };
+		uint64_t streamedLevels{ 0 };
+	};
+	const Statistics& GetStatistics()const { return statistics; }
+
+private:
+	struct Entry {
+		std::string path;
+		std::unique_ptr<Texture> texture;
+		uint64_t lastUse{ 0 };
+	};
+
+	//Decodes the file with its own channel count and builds the full mip chain in the managed format, or maps it from the cache when one is set.
+	//Safe to call from several threads
+	std::unique_ptr<Texture> Load(const std::string& path, bool* hit = nullptr, TextureLoadTime* time = nullptr)const;
+	//Bytes of the levels [first, last)
+	static uint64_t LevelBytes(const Texture& texture, size_t first, size_t last);
+	//Bytes every texture except keep could give up
+	uint64_t EvictableBytes(size_t keep)const;
+	void EvictLevel(Entry& entry);
+	//Evicts from the least recently used textures other than keep until bytes more fit or nothing is left to give up
+	void MakeRoom(uint64_t bytes, size_t keep);
+
+	std::vector<Entry> entries;
+	uint64_t budget;
+	uint64_t residentBytes{ 0 };
+	uint64_t useCounter{ 0 };
+	TextureFormat format;
+	const TextureCache* cache{ nullptr };
+	Statistics statistics;
+};
\ No newline at end of file
@@ -0,0 +1,56 @@
+#include "MathBaseline.h"
+
+static float BaselineDot(Vector4f v0, Vector4f v1) {
+	return v0.x * v1.x + v0.y * v1.y + v0.z * v1.z + v0.w * v1.w;
+}
+
+static float BaselineLerp(float v0, float v1, float percent) {
+	return v0 * (1.0f - percent) + v1 * percent;
+}
+
+Vector4f BaselineAdd(const Vector4f& v0, const Vector4f& v1) {
+	return Vector4f(v0.x + v1.x, v0.y + v1.y, v0.z + v1.z, v0.w + v1.w);
+}
+
+Vector4f BaselineMultiply(const Vector4f& v0, const Vector4f& v1) {
+	return Vector4f(v0.x * v1.x, v0.y * v1.y, v0.z * v1.z, v0.w * v1.w);
+}
+
+Vector4f BaselineLerp(Vector4f v0, Vector4f v1, float percent) {
+	return Vector4f(
+		BaselineLerp(v0.x, v1.x, percent),
+		BaselineLerp(v0.y, v1.y, percent),
+		BaselineLerp(v0.z, v1.z, percent),
+		BaselineLerp(v0.w, v1.w, percent)
+	);
+}
+
+Vector4f BaselineMultiply(Vector4f v, Matrix4x4f m) {
+	return Vector4f(
+		BaselineDot(v, m.GetColumnVector1()),
+		BaselineDot(v, m.GetColumnVector2()),
+		BaselineDot(v, m.GetColumnVector3()),
+		BaselineDot(v, m.GetColumnVector4())
+	);
+}
+
+Matrix4x4f BaselineMultiply(Matrix4x4f m0, Matrix4x4f m1) {
+	Matrix4x4f matrix;
+	matrix.a1 = BaselineDot(m0.GetRowVector1(), m1.GetColumnVector1());
+	matrix.a2 = BaselineDot(m0.GetRowVector1(), m1.GetColumnVector2());
+	matrix.a3 = BaselineDot(m0.GetRowVector1(), m1.GetColumnVector3());
+	matrix.a4 = BaselineDot(m0.GetRowVector1(), m1.GetColumnVector4());
+	matrix.b1 = BaselineDot(m0.GetRowVector2(), m1.GetColumnVector1());
+	matrix.b2 = BaselineDot(m0.GetRowVector2(), m1.GetColumnVector2());
+	matrix.b3 = BaselineDot(m0.GetRowVector2(), m1.GetColumnVector3());
+	matrix.b4 = BaselineDot(m0.GetRowVector2(), m1.GetColumnVector4());
+	matrix.c1 = BaselineDot(m0.GetRowVector3(), m1.GetColumnVector1());
+	matrix.c2 = BaselineDot(m0.GetRowVector3(), m1.GetColumnVector2());
+	matrix.c3 = BaselineDot(m0.GetRowVector3(), m1.GetColumnVector3());
+	matrix.c4 = BaselineDot(m0.GetRowVector3(), m1.GetColumnVector4());
+	matrix.d1 = BaselineDot(m0.GetRowVector4(), m1.GetColumnVector1());
+	matrix.d2 = BaselineDot(m0.GetRowVector4(), m1.GetColumnVector2());
+	matrix.d3 = BaselineDot(m0.GetRowVector4(), m1.GetColumnVector3());
+	matrix.d4 = BaselineDot(m0.GetRowVector4(), m1.GetColumnVector4());
+	return matrix;
+}
\ No newline at end of file
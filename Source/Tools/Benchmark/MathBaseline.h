@@ -0,0 +1,10 @@
+#pragma once
+#include "Core/Math/Math.h"
+
+//Copies of the math core as it was before it moved inline into Math.h: scalar, and defined in their own translation
+//unit so every call stays a call, as it did from Math.cpp. MathBenchmark times them next to the current code
+Vector4f BaselineAdd(const Vector4f& v0, const Vector4f& v1);
+Vector4f BaselineMultiply(const Vector4f& v0, const Vector4f& v1);
+Vector4f BaselineLerp(Vector4f v0, Vector4f v1, float percent);
+Vector4f BaselineMultiply(Vector4f v, Matrix4x4f m);
+Matrix4x4f BaselineMultiply(Matrix4x4f m0, Matrix4x4f m1);
\ No newline at end of file
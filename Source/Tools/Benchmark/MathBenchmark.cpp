@@ -0,0 +1,105 @@
+//Per call timings of the inline math core next to the out-of-line scalar code it replaced, best of several runs.
+//Built as is it measures the SSE or NEON path, built with MATH_NO_SIMD defined the scalar one.
+//Build together with MathBaseline.cpp and Core/Math/Math.cpp, without link time optimization so the baseline stays out of line.
+//Usage: MathBenchmark [runs]
+#include "MathBaseline.h"
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using Clock = std::chrono::high_resolution_clock;
+
+const size_t vectorCount = 4096;
+const int repeats = 100;
+const int matrixCalls = 100000;
+
+struct CurrentMath {
+	static Vector4f Add(const Vector4f& v0, const Vector4f& v1) { return v0 + v1; }
+	static Vector4f Multiply(const Vector4f& v0, const Vector4f& v1) { return v0 * v1; }
+	static Vector4f Lerp(Vector4f v0, Vector4f v1, float percent) { return ::Lerp(v0, v1, percent); }
+	static Vector4f Multiply(Vector4f v, Matrix4x4f m) { return ::Multiply(v, m); }
+	static Matrix4x4f Multiply(Matrix4x4f m0, Matrix4x4f m1) { return ::Multiply(m0, m1); }
+};
+
+struct BaselineMath {
+	static Vector4f Add(const Vector4f& v0, const Vector4f& v1) { return BaselineAdd(v0, v1); }
+	static Vector4f Multiply(const Vector4f& v0, const Vector4f& v1) { return BaselineMultiply(v0, v1); }
+	static Vector4f Lerp(Vector4f v0, Vector4f v1, float percent) { return BaselineLerp(v0, v1, percent); }
+	static Vector4f Multiply(Vector4f v, Matrix4x4f m) { return BaselineMultiply(v, m); }
+	static Matrix4x4f Multiply(Matrix4x4f m0, Matrix4x4f m1) { return BaselineMultiply(m0, m1); }
+};
+
+struct Timings {
+	double vectorMatrix{ DBL_MAX };
+	double lerp{ DBL_MAX };
+	double matrixMatrix{ DBL_MAX };
+	//The accumulated results are printed, so the loops can not be removed as dead code
+	float checksum{ 0.0f };
+};
+
+static double Nanoseconds(Clock::time_point start, Clock::time_point end, double calls) {
+	return std::chrono::duration<double, std::nano>(end - start).count() / calls;
+}
+
+template<typename Implementation> static Timings Measure(const std::vector<Vector4f>& vectors, const Matrix4x4f& matrix, int runs) {
+	Timings timings;
+	Vector4f sum(0.0f);
+	Matrix4x4f product(1.0f);
+	for (int run = 0; run < runs; run++) {
+		auto start = Clock::now();
+		for (int k = 0; k < repeats; k++) {
+			for (auto& vector : vectors)
+				sum = Implementation::Add(sum, Implementation::Multiply(vector, matrix));
+		}
+		auto end = Clock::now();
+		timings.vectorMatrix = std::min(timings.vectorMatrix, Nanoseconds(start, end, (double)repeats * vectorCount));
+
+		start = Clock::now();
+		for (int k = 0; k < repeats; k++) {
+			for (size_t i = 0; i + 1 < vectorCount; i++)
+				sum = Implementation::Add(sum, Implementation::Multiply(Implementation::Lerp(vectors[i], vectors[i + 1], 0.25f), vectors[i]));
+		}
+		end = Clock::now();
+		timings.lerp = std::min(timings.lerp, Nanoseconds(start, end, (double)repeats * (vectorCount - 1)));
+
+		start = Clock::now();
+		for (int k = 0; k < matrixCalls; k++) {
+			product = Implementation::Multiply(product, matrix);
+		}
+		end = Clock::now();
+		timings.matrixMatrix = std::min(timings.matrixMatrix, Nanoseconds(start, end, matrixCalls));
+	}
+	timings.checksum = sum.x + sum.y + product.a1;
+	return timings;
+}
+
+int main(int argc, char* argv[]) {
+	int runs = argc > 1 ? atoi(argv[1]) : 20;
+	if (runs < 1) runs = 1;
+
+	Matrix4x4f matrix = Multiply(RotateX(0.3f), Translate(1.0f, 2.0f, 3.0f));
+	std::vector<Vector4f> vectors(vectorCount);
+	for (size_t i = 0; i < vectorCount; i++) {
+		vectors[i] = Vector4f((float)i, 1.0f, 2.0f, 1.0f);
+	}
+
+	Timings baseline = Measure<BaselineMath>(vectors, matrix, runs);
+	Timings current = Measure<CurrentMath>(vectors, matrix, runs);
+
+#if defined(MATH_SSE)
+	const char* path = "SSE";
+#elif defined(MATH_NEON)
+	const char* path = "NEON";
+#else
+	const char* path = "scalar";
+#endif
+	printf("Best of %d runs, ns per call    out of line   inline %s\n", runs, path);
+	printf("Multiply(Vector4f, Matrix4x4f):   %6.2f        %6.2f\n", baseline.vectorMatrix, current.vectorMatrix);
+	printf("Lerp and multiply:                %6.2f        %6.2f\n", baseline.lerp, current.lerp);
+	printf("Multiply(Matrix4x4f, Matrix4x4f): %6.2f        %6.2f\n", baseline.matrixMatrix, current.matrixMatrix);
+	printf("(checksums %f %f)\n", baseline.checksum, current.checksum);
+	return 0;
+}
\ No newline at end of file
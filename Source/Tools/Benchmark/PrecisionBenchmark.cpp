@@ -0,0 +1,104 @@
+//Error and per call timings of the MathPrecision tiers of FastMath.h. Errors are relative to double precision over the
+//ranges the header documents, timings are the best of several runs.
+//Usage: PrecisionBenchmark [runs]
+#include "Core/Math/FastMath.h"
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using Clock = std::chrono::high_resolution_clock;
+
+const size_t sampleCount = 1 << 16;
+
+struct Inputs {
+	std::vector<Vector3f> vectors;
+	std::vector<float> bases;
+	std::vector<float> exponents;
+};
+
+struct Result {
+	double normalizeError{ 0.0 }, powError{ 0.0 }, pow5Error{ 0.0 };
+	double normalizeTime{ DBL_MAX }, powTime{ DBL_MAX }, pow5Time{ DBL_MAX };
+	float checksum{ 0.0f };
+};
+
+static double RelativeError(double value, double reference) {
+	return reference != 0.0 ? fabs(value - reference) / fabs(reference) : fabs(value);
+}
+
+template<MathPrecision precision> static Result Measure(const Inputs& inputs, int runs) {
+	Result result;
+	for (size_t i = 0; i < sampleCount; i++) {
+		const Vector3f& v = inputs.vectors[i];
+		double length = sqrt((double)v.x * v.x + (double)v.y * v.y + (double)v.z * v.z);
+		//Relative to the unit length of the result
+		Vector3f n = Normalize<precision>(v);
+		double error = std::max(fabs(n.x - v.x / length), std::max(fabs(n.y - v.y / length), fabs(n.z - v.z / length)));
+		result.normalizeError = std::max(result.normalizeError, error);
+
+		//The Pow bound scales with the magnitude of y * log2(x). Results below the normal range lose precision in
+		//every tier, the C library included, and are left out
+		double x = inputs.bases[i], y = inputs.exponents[i];
+		double scale = std::max(1.0, fabs(y * log2(x)));
+		if (pow(x, y) >= FLT_MIN)
+			result.powError = std::max(result.powError, RelativeError(Pow<precision>((float)x, (float)y), pow(x, y)) / scale);
+		result.pow5Error = std::max(result.pow5Error, RelativeError(Pow5<precision>((float)x), pow(x, 5.0)));
+	}
+
+	//The accumulated results are printed, so the loops can not be removed as dead code
+	float& sum = result.checksum;
+	for (int run = 0; run < runs; run++) {
+		auto start = Clock::now();
+		for (size_t i = 0; i < sampleCount; i++) {
+			sum += Normalize<precision>(inputs.vectors[i]).x;
+		}
+		auto end = Clock::now();
+		result.normalizeTime = std::min(result.normalizeTime, std::chrono::duration<double, std::nano>(end - start).count() / sampleCount);
+
+		start = Clock::now();
+		for (size_t i = 0; i < sampleCount; i++) {
+			sum += Pow<precision>(inputs.bases[i], inputs.exponents[i]);
+		}
+		end = Clock::now();
+		result.powTime = std::min(result.powTime, std::chrono::duration<double, std::nano>(end - start).count() / sampleCount);
+
+		start = Clock::now();
+		for (size_t i = 0; i < sampleCount; i++) {
+			sum += Pow5<precision>(inputs.bases[i]);
+		}
+		end = Clock::now();
+		result.pow5Time = std::min(result.pow5Time, std::chrono::duration<double, std::nano>(end - start).count() / sampleCount);
+	}
+	return result;
+}
+
+static void Print(const char* name, const Result& result) {
+	printf("%-12s %9.2e %9.2e %9.2e   %7.2f %7.2f %7.2f   (checksum %g)\n", name, result.normalizeError, result.powError, result.pow5Error,
+		result.normalizeTime, result.powTime, result.pow5Time, result.checksum);
+}
+
+int main(int argc, char* argv[]) {
+	int runs = argc > 1 ? atoi(argv[1]) : 20;
+	if (runs < 1) runs = 1;
+
+	//x in (0, 1] and y in [1, 256], as in specular and spot light falloff
+	Inputs inputs;
+	srand(1);
+	for (size_t i = 0; i < sampleCount; i++) {
+		auto random = []() { return (float)rand() / (float)RAND_MAX; };
+		inputs.vectors.push_back(Vector3f(random() * 2.0f - 1.0f, random() * 2.0f - 1.0f, random() * 2.0f - 1.0f + 1e-3f));
+		inputs.bases.push_back(std::max(random(), 1e-6f));
+		inputs.exponents.push_back(1.0f + random() * 255.0f);
+	}
+
+	printf("             max relative error              ns per call\n");
+	printf("tier         Normalize Pow       Pow5        Normalize Pow   Pow5\n");
+	Print("Precise", Measure<MathPrecision::Precise>(inputs, runs));
+	Print("Fast", Measure<MathPrecision::Fast>(inputs, runs));
+	Print("Approximate", Measure<MathPrecision::Approximate>(inputs, runs));
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,147 @@
+//Bilinear sampling of a large RGBA8 texture through a rotated and scaled screen, once per texel layout. Reports the
+//miss rate of a simulated L1 cache on the texel addresses and the best-of-N wall clock time per sample.
+//Wall clock numbers vary a lot between runs and machines, the miss rates are the stable signal.
+//Usage: TextureLayoutBenchmark [runs]
+#include "Function/Texture/Texture.h"
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using Clock = std::chrono::high_resolution_clock;
+
+const uint32_t textureSize = 4096;
+const uint32_t screenSize = 512;
+
+//Set associative with LRU replacement, 32 KiB in 8 ways of 64 byte lines by default
+class CacheSimulator {
+public:
+	CacheSimulator(size_t size = 32 * 1024, size_t ways = 8, size_t lineSize = 64)
+		: ways(ways), lineSize(lineSize), setCount(size / (ways * lineSize)), tags(setCount * ways, UINT64_MAX), ages(setCount * ways, 0) {}
+
+	void Access(uint64_t address) {
+		uint64_t line = address / lineSize;
+		size_t set = (size_t)(line % setCount);
+		uint64_t* setTags = &tags[set * ways];
+		uint64_t* setAges = &ages[set * ways];
+		accesses++;
+		time++;
+		size_t oldest = 0;
+		for (size_t i = 0; i < ways; i++) {
+			if (setTags[i] == line) {
+				setAges[i] = time;
+				return;
+			}
+			if (setAges[i] < setAges[oldest])
+				oldest = i;
+		}
+		misses++;
+		setTags[oldest] = line;
+		setAges[oldest] = time;
+	}
+	double GetMissRate()const { return accesses ? (double)misses / accesses : 0.0; }
+
+private:
+	size_t ways, lineSize, setCount;
+	std::vector<uint64_t> tags, ages;
+	uint64_t time{ 0 }, accesses{ 0 }, misses{ 0 };
+};
+
+//Mirrors the texel addressing of Texture.cpp for a square power of two image
+static uint64_t TexelIndex(TextureLayout layout, uint32_t x, uint32_t y) {
+	if (layout == TextureLayout::Tiled4x4)
+		return ((uint64_t)(y >> 2) * (textureSize >> 2) + (x >> 2)) * 16 + ((y & 3) << 2) + (x & 3);
+	if (layout == TextureLayout::Morton) {
+		uint64_t index = 0;
+		for (uint32_t bit = 0; bit < 16; bit++) {
+			index |= (uint64_t)((x >> bit) & 1) << (2 * bit) | (uint64_t)((y >> bit) & 1) << (2 * bit + 1);
+		}
+		return index;
+	}
+	return (uint64_t)y * textureSize + x;
+}
+
+//Texture coordinates of every pixel, the screen center maps to the texture center
+static std::vector<Vector2f> ScreenCoords(float scale, float degrees) {
+	float radians = degrees * 3.14159265f / 180.0f;
+	float c = cosf(radians) * scale, s = sinf(radians) * scale;
+	std::vector<Vector2f> coords;
+	coords.reserve((size_t)screenSize * screenSize);
+	for (uint32_t y = 0; y < screenSize; y++) {
+		for (uint32_t x = 0; x < screenSize; x++) {
+			float dx = x + 0.5f - screenSize * 0.5f, dy = y + 0.5f - screenSize * 0.5f;
+			coords.push_back(Vector2f((textureSize * 0.5f + c * dx - s * dy) / textureSize, (textureSize * 0.5f + s * dx + c * dy) / textureSize));
+		}
+	}
+	return coords;
+}
+
+//The four texels of every bilinear footprint with repeat addressing
+static double SimulateMissRate(const std::vector<Vector2f>& coords, TextureLayout layout) {
+	CacheSimulator cache;
+	for (auto& coord : coords) {
+		float x = coord.x * textureSize - 0.5f, y = coord.y * textureSize - 0.5f;
+		int x0 = (int)floorf(x), y0 = (int)floorf(y);
+		for (int j = 0; j < 2; j++) {
+			for (int i = 0; i < 2; i++) {
+				uint32_t texelX = (uint32_t)(x0 + i) & (textureSize - 1), texelY = (uint32_t)(y0 + j) & (textureSize - 1);
+				cache.Access(TexelIndex(layout, texelX, texelY) * 4);
+			}
+		}
+	}
+	return cache.GetMissRate();
+}
+
+int main(int argc, char* argv[]) {
+	int runs = argc > 1 ? atoi(argv[1]) : 5;
+	if (runs < 1) runs = 1;
+
+	std::vector<stbi_uc> texels((size_t)textureSize * textureSize * 4);
+	srand(1);
+	for (auto& texel : texels) {
+		texel = (stbi_uc)(rand() & 0xff);
+	}
+
+	const TextureLayout layouts[] = { TextureLayout::Linear, TextureLayout::Tiled4x4, TextureLayout::Morton };
+	Texture textures[3];
+	for (size_t i = 0; i < 3; i++) {
+		textures[i].LoadImageFromMemory(textureSize, textureSize, 32, texels.data(), 0);
+		textures[i].SetLayout(layouts[i]);
+	}
+
+	struct Case {
+		float scale, degrees;
+	};
+	const Case cases[] = { { 1.0f, 0.0f }, { 1.0f, 30.0f }, { 1.0f, 90.0f }, { 4.0f, 30.0f }, { 4.0f, 90.0f } };
+
+	printf("%ux%u RGBA8, %ux%u bilinear samples, miss rate / ns per sample\n\n", textureSize, textureSize, screenSize, screenSize);
+	printf("                Linear          Tiled4x4        Morton\n");
+	Sampler sampler(Sampler::Filter::Linear, Sampler::AddressMode::Repeat, Sampler::AddressMode::Repeat);
+	float checksum = 0.0f;
+	for (auto& test : cases) {
+		std::vector<Vector2f> coords = ScreenCoords(test.scale, test.degrees);
+		printf("%2.0fx, %2.0f deg  ", test.scale, test.degrees);
+		for (size_t i = 0; i < 3; i++) {
+			double best = DBL_MAX;
+			for (int run = 0; run < runs; run++) {
+				auto start = Clock::now();
+				for (auto& coord : coords) {
+					checksum += textures[i].Sample(sampler, coord).x;
+				}
+				auto end = Clock::now();
+				best = std::min(best, std::chrono::duration<double, std::nano>(end - start).count() / coords.size());
+			}
+			printf("%5.1f%% %5.0f    ", SimulateMissRate(coords, layouts[i]) * 100.0, best);
+		}
+		printf("\n");
+	}
+	printf("\n(checksum %g)\n", checksum);
+
+	for (auto& texture : textures) {
+		texture.Release();
+	}
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,86 @@
+//Headless replay of a frame capture written by CaptureWriter.
+//Usage: Replay <capture file> [iterations] [output.png]
+#include "Core/Rasterization/Capture.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb/stb_image_write.h"
+#include <chrono>
+#include <cstdio>
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		printf("Usage: %s <capture file> [iterations] [output.png]\n", argv[0]);
+		return 1;
+	}
+
+	CaptureReader reader;
+	if (!reader.Open(argv[1])) {
+		printf("Failed to open capture %s\n", argv[1]);
+		return 1;
+	}
+	int iterations = argc > 2 ? atoi(argv[2]) : 1;
+	if (iterations < 1) iterations = 1;
+
+	auto& header = reader.GetHeader();
+	GouraudShaderPipeline pipeline(header.width, header.height, (SampleCount)header.sampleCount);
+	printf("Capture %s: %ux%u, %u samples\n", argv[1], header.width, header.height, 1u << header.sampleCount);
+
+	std::vector<ReplayDrawRecord> records;
+	double totalMilliseconds = 0.0, minMilliseconds = DBL_MAX, maxMilliseconds = 0.0;
+
+	for (int i = 0; i < iterations; i++) {
+		records.clear();
+		pipeline.ResetStatistics();
+
+		auto start = std::chrono::high_resolution_clock::now();
+		if (!reader.Replay(pipeline, &records)) {
+			printf("Capture is truncated or corrupted\n");
+			return 1;
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+
+		double milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+		totalMilliseconds += milliseconds;
+		minMilliseconds = std::min(minMilliseconds, milliseconds);
+		maxMilliseconds = std::max(maxMilliseconds, milliseconds);
+		printf("Iteration %d: %.3f ms\n", i, milliseconds);
+	}
+
+	printf("Frame time: avg %.3f ms, min %.3f ms, max %.3f ms\n", totalMilliseconds / iterations, minMilliseconds, maxMilliseconds);
+
+	//Statistics and draw timings of the last iteration
+	auto& statistics = pipeline.GetStatistics();
+	printf("Draw calls: %llu\n", (unsigned long long)statistics.drawCalls);
+	printf("Input vertices: %llu\n", (unsigned long long)statistics.inputVertices);
+	printf("Input primitives: %llu\n", (unsigned long long)statistics.inputPrimitives);
+	printf("Vertex shader invocations: %llu\n", (unsigned long long)statistics.vertexShaderInvocations);
+	printf("Fragment shader invocations: %llu\n", (unsigned long long)statistics.fragmentShaderInvocations);
+	printf("Culled instances: %llu\n", (unsigned long long)statistics.culledInstances);
+	printf("Culled primitives: %llu\n", (unsigned long long)statistics.culledPrimitives);
+
+	std::sort(records.begin(), records.end(), [](const ReplayDrawRecord& a, const ReplayDrawRecord& b) {
+		return a.milliseconds > b.milliseconds;
+	});
+	printf("Slowest draws:\n");
+	for (size_t i = 0; i < records.size() && i < 10; i++) {
+		const char* name = records[i].command == CaptureCommand::MultiDrawIndexedIndirect ? "MultiDrawIndexedIndirect" :
+			records[i].command == CaptureCommand::DrawIndexedInstanced ? "DrawIndexedInstanced" :
+			records[i].command == CaptureCommand::DrawIndexed ? "DrawIndexed" : "Draw";
+		printf("  %s topology %u, %zu elements: %.3f ms\n", name,
+			(uint32_t)records[i].topologyType, records[i].count, records[i].milliseconds);
+	}
+
+	if (argc > 3) {
+		std::vector<uint8_t> pixels(header.width * header.height * 3);
+		for (uint32_t y = 0; y < header.height; y++) {
+			for (uint32_t x = 0; x < header.width; x++) {
+				Vector3f color = saturate(pipeline.ReadFramebuffer(x, y));
+				pixels[(y * header.width + x) * 3] = (uint8_t)(color.x * 255);
+				pixels[(y * header.width + x) * 3 + 1] = (uint8_t)(color.y * 255);
+				pixels[(y * header.width + x) * 3 + 2] = (uint8_t)(color.z * 255);
+			}
+		}
+		stbi_write_png(argv[3], header.width, header.height, 3, pixels.data(), header.width * 3);
+	}
+
+	return 0;
+}
\ No newline at end of file
@@ -1,10 +1,15 @@
 #include "Core/Rasterization/Renderer.h"
+#include "Core/Rasterization/Capture.h"
 #include "Function/Model/Model.h"
 #include "Function/Camera/Camera.h"
+#include "Function/Texture/TextureManager.h"
+#include "Function/Texture/TextureAtlas.h"
 #include "Function/Tessellation/Tessellation.h"
 
 const int width = 600;
 const int height = 400;
+//Resident texture memory, textures past it keep only their coarser mip levels
+const uint64_t textureBudget = 256ull << 20;
 
 int main(int argc, char* argv[]) {
 	SDL_Window* window;
@@ -16,24 +21,88 @@ int main(int argc, char* argv[]) {
 
 	Model model("Assets\\Model.fbx");
 
-	std::vector<Texture> textures(model.texturePath.size());
-	for (int i = 0; i < textures.size(); i++) {
-		textures[i].LoadImageWithSTB(model.texturePath[i].c_str(), 32);
+	//Converted textures are kept on disk, later runs map them instead of decoding
+	TextureCache textureCache("TextureCache");
+	TextureManager textureManager(textureBudget);
+	textureManager.SetCache(&textureCache);
+
+	//Small textures of materials whose texture coordinates stay inside [0, 1] share atlas pages, so their draws merge.
+	//Materials sharing a texture share its region, and pages are only rebuilt when a source changed
+	std::vector<std::string> atlasPaths;
+	std::vector<size_t> atlasMaterials;
+	for (size_t i = 0; i < model.renderInfo.size(); i++) {
+		auto& r = model.renderInfo[i];
+		if (TextureAtlas::FitsRegion(r.vertices.data(), r.vertices.size())) {
+			atlasPaths.push_back(model.texturePath[model.materials[i].diffuseMaps]);
+			atlasMaterials.push_back(i);
+		}
+	}
+	TextureAtlas textureAtlas;
+	bool atlasBuilt = textureAtlas.Build(atlasPaths, "TextureCache");
+
+	//One managed texture per atlas page and per texture left on its own
+	std::vector<std::string> texturePaths;
+	std::vector<size_t> materialTextures(model.renderInfo.size(), SIZE_MAX);
+	for (size_t page = 0; atlasBuilt && page < textureAtlas.GetPageCount(); page++)
+		texturePaths.push_back(textureAtlas.GetPagePath(page));
+	for (size_t i = 0; atlasBuilt && i < atlasMaterials.size(); i++) {
+		auto& region = textureAtlas.GetRegion(i);
+		if (region.page == SIZE_MAX)
+			continue;
+		materialTextures[atlasMaterials[i]] = region.page;
+		for (auto& vertex : model.renderInfo[atlasMaterials[i]].vertices)
+			vertex.texCoord = region.Transform(vertex.texCoord);
+	}
+	for (size_t i = 0; i < materialTextures.size(); i++) {
+		if (materialTextures[i] == SIZE_MAX) {
+			materialTextures[i] = texturePaths.size();
+			texturePaths.push_back(model.texturePath[model.materials[i].diffuseMaps]);
+		}
 	}
+	for (auto& path : texturePaths)
+		textureManager.Register(path);
+
+	//Loads every texture on all cores up front instead of on first bind, evicting down to the budget as each one finishes
+	std::vector<TextureLoadTime> loadTimes;
+	textureManager.Preload(&loadTimes);
+	for (size_t i = 0; i < loadTimes.size(); i++)
+		printf("%s: decode %.1f ms, mips %.1f ms\n", texturePaths[i].c_str(), loadTimes[i].decodeMilliseconds, loadTimes[i].mipMilliseconds);
+
+	//Materials are laid out grouped by texture, each group is one draw
+	struct DrawRange {
+		size_t texture;
+		size_t indexOffset;
+		size_t indexCount;
+	};
+	std::vector<size_t> materialOrder(model.renderInfo.size());
+	for (size_t i = 0; i < materialOrder.size(); i++)
+		materialOrder[i] = i;
+	std::stable_sort(materialOrder.begin(), materialOrder.end(), [&](size_t a, size_t b) { return materialTextures[a] < materialTextures[b]; });
 
 	std::vector<Vertex> vertices;
 	std::vector<uint32_t> indices;
-	for (auto& r : model.renderInfo) {
+	std::vector<DrawRange> draws;
+	for (size_t material : materialOrder) {
+		auto& r = model.renderInfo[material];
+		if (draws.empty() || draws.back().texture != materialTextures[material])
+			draws.push_back({ materialTextures[material], indices.size(), 0 });
 		for (auto& i : r.indices)
 			indices.push_back(i + vertices.size());
+		draws.back().indexCount += r.indices.size();
 		vertices.insert(vertices.end(), r.vertices.begin(), r.vertices.end());
 	}
+	printf("%zu materials in %zu draws, %zu atlas pages\n", model.renderInfo.size(), draws.size(), textureAtlas.GetPageCount());
 
 	Camera camera((float)width / (float)height);
 	camera.SetLens(0.25f * M_PI, (float)width / height, 0.1f, 1000.0f);
 	camera.LookAt(Vector3f(0.0f, 10.0f, 30.0f), Vector3f(0.0f, 10.0f, 0.0f), Vector3f(0.0f, 1.0f, 0.0f));
 	camera.UpdataViewMatrix();
 
+	//Passing "-capture <file>" records the frame for the Replay tool
+	CaptureWriter capture;
+	if (argc > 2 && strcmp(argv[1], "-capture") == 0 && capture.Begin(argv[2], pipeline))
+		pipeline.SetCapture(&capture);
+
 	pipeline.Clear(Vector4f(0.0f, 0.0f, 0.0f, 0.0f), FLT_MAX);
 
 	Light light;
@@ -49,27 +118,34 @@ int main(int argc, char* argv[]) {
 	shader.passConstant.projMatrix = camera.GetProjMatrix4x4f();
 
 	shader.objectConstant.worldMatrix = RotateX(-M_PI * 0.5f);
-	shader.objectConstant.normalMatrix = shader.objectConstant.worldMatrix.Inverse().Transpose();
+	shader.objectConstant.normalMatrix = NormalMatrix(shader.objectConstant.worldMatrix, TransformType::Rotation);
 
 	shader.materialConstant.diffuseAlbedo = Vector4f(1.0f);
 	shader.materialConstant.fresnelR0 = Vector3f(0.5f, 0.5f, 0.5f);
 	shader.materialConstant.roughness = 0.2f;
 
 	shader.sampler = Sampler(Sampler::Filter::Linear, Sampler::AddressMode::Repeat, Sampler::AddressMode::Repeat);
+	shader.sampler.SetMipFilter(Sampler::MipFilter::Linear);
 	shader.sampler.SetBorderColor(Vector4f(0.0f, 0.0f, 0.0f, 1.0f));
 
 	pipeline.SetVertexBuffer(vertices.data());
 	pipeline.SetIndexBuffer(indices.data());
 	pipeline.SetTopologyType(TopologyType::TriangleList);
+	pipeline.SetBlendState(BlendState::Opaque);
+
+	RasterizerState rasterizerState;
+	rasterizerState.cullMode = CullMode::Back;
+	pipeline.SetRasterizerState(rasterizerState);
 
-	int baseOffset = 0;
-	for (int i = 0; i < model.renderInfo.size(); i++) {
-		shader.texture = &textures[i];
+	for (auto& draw : draws) {
+		shader.texture = textureManager.Bind(draw.texture);
 		pipeline.SetShader(shader);
-		pipeline.DrawIndexed(baseOffset, 0, model.renderInfo[i].indices.size());
-		baseOffset += model.renderInfo[i].indices.size();
+		pipeline.DrawIndexed(draw.indexOffset, 0, draw.indexCount);
 	}
 
+	pipeline.SetCapture(nullptr);
+	capture.End();
+
 	renderer.Present(&pipeline);
 
 	bool quit = false;